@@ -1,36 +1,62 @@
+#include <array>
 #include <iostream>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
 #include "AGCIE.h"
+#include "Histogram.h"
+#include "ValueGain.h"
 #include "util.h"
-#include <android/log.h>
+#include "ImageProcLog.h"
+#include "Trace.h"
 void AGCIE(const cv::Mat & src, cv::Mat & dst)
 {
-    int rows = src.rows;
-    int cols = src.cols;
+    EnhanceBuffers buffers;
+    AGCIE(src, dst, buffers);
+}
+
+void AGCIE(const cv::Mat & src, cv::Mat & dst, EnhanceBuffers & buffers, int histogramStep, int bitDepth)
+{
+    if (src.depth() == CV_16U) {
+        AGCIE16(src, dst, bitDepth);
+        return;
+    }
+    IMGPROC_TRACE_SCOPE("AGCIE");
     int channels = src.channels();
-    int total_pixels = rows * cols;
 
-    cv::Mat L;
-    cv::Mat HSV;
-    std::vector<cv::Mat> HSV_channels;
+    // Only the HSV value V = max(B, G, R) is enhanced, so its histogram is taken straight from
+    // the colour pixels and the LUT is applied by scaling them (see ValueGain.h).
+    Histogram256 hist;
     if (channels == 1) {
-        L = src.clone();
+        histogram256(src, hist, true, histogramStep);
     }
     else {
-        cv::cvtColor(src, HSV, cv::COLOR_BGR2HSV_FULL);
-        cv::split(HSV, HSV_channels);
-        L = HSV_channels[2];
+        histogramMaxRGB(src, hist, true, histogramStep);
     }
 
-    cv::Mat L_norm;
-    L.convertTo(L_norm, CV_64F, 1.0 / 255.0);
+    // Statistics of V / 255.
+    double mu, sigma;
+    histogramMeanStdDev(hist, mu, sigma);
 
-    cv::Mat mean, stddev;
-    cv::meanStdDev(L_norm, mean, stddev);
-    double mu = mean.at<double>(0, 0);
-    double sigma = stddev.at<double>(0, 0);
+    std::array<uchar, 256> table_uchar;
+    AGCIETable(mu, sigma, table_uchar);
 
+    if (channels == 1) {
+        cv::LUT(src, table_uchar, dst);
+    }
+    else {
+        // An RGBA dst (e.g. a locked bitmap) is written in place; anything else gets 3 channels.
+        applyValueLUT(src, dst, table_uchar);
+    }
+
+    return;
+}
+
+// Fills table[0 .. size) with the AGCIE curve over [0, maxValue].
+template<typename Table>
+static void AGCIECurve(double mu, double sigma, Table& table, double maxValue)
+{
+    typedef typename Table::value_type value_type;
     double tau = 3.0;
 
     double gamma;
@@ -41,52 +67,54 @@ void AGCIE(const cv::Mat & src, cv::Mat & dst)
         gamma = std::exp((1.0 - mu - sigma) / 2.0);
     }
 
-    std::vector<double> table_double(256, 0);
-    for (int i = 1; i < 256; i++) {
-        table_double[i] = i / 255.0;
-    }
-
-    if (mu >= 0.5) { // bright image
-        for (int i = 1; i < 256; i++) {
-            table_double[i] = std::pow(table_double[i], gamma);
+    const size_t levels = table.size();
+    const double mu_gamma = std::pow(mu, gamma);
+    table[0] = 0;
+    for (size_t i = 1; i < levels; i++) {
+        double in = (double)i / (levels - 1);
+        double out;
+        if (mu >= 0.5) { // bright image
+            out = std::pow(in, gamma);
         }
-    }
-    else { // dark image
-        double mu_gamma = std::pow(mu, gamma);
-        for (int i = 1; i < 256; i++) {
-            double in_gamma = std::pow(table_double[i], gamma);;
-            table_double[i] = in_gamma / (in_gamma + (1.0 - in_gamma) * mu_gamma);
+        else { // dark image
+            double in_gamma = std::pow(in, gamma);
+            out = in_gamma / (in_gamma + (1.0 - in_gamma) * mu_gamma);
         }
+        table[i] = cv::saturate_cast<value_type>(maxValue * out);
     }
+}
 
-    std::vector<uchar> table_uchar(256, 0);
-    for (int i = 1; i < 256; i++) {
-        table_uchar[i] = cv::saturate_cast<uchar>(255.0 * table_double[i]);
-    }
+void AGCIETable(double mu, double sigma, std::array<uchar, 256>& table_uchar)
+{
+    AGCIECurve(mu, sigma, table_uchar, 255.0);
+}
 
-    cv::LUT(L, table_uchar, L);
+void AGCIE16(const cv::Mat & src, cv::Mat & dst, int bitDepth)
+{
+    IMGPROC_TRACE_SCOPE("AGCIE16");
+    CV_Assert( bitDepth >= 9 && bitDepth <= 16 );
+    const int maxValue = (1 << bitDepth) - 1;
 
-    if (channels == 1) {
-        dst = L.clone();
-    }
-    else {
-        cv::merge(HSV_channels, dst);
-        cv::cvtColor(dst, dst, cv::COLOR_HSV2BGR_FULL);
-    }
+    std::vector<uint32_t> hist;
+    histogram16(src, hist, bitDepth);
+    double mu, sigma;
+    histogramMeanStdDev(hist, mu, sigma, 1.0 / maxValue);
 
-    return;
+    std::vector<ushort> table(hist.size());
+    AGCIECurve(mu, sigma, table, maxValue);
+    applyValueLUT16(src, dst, table);
 }
 
 void downscaleAGCIE(const cv::Mat & src, cv::Mat & dst)
 {
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCIE Downscale src row : %d cols : %d", src.rows,src.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCIE Downscale src row : %d cols : %d", src.rows,src.cols);
     cv::resize(src, dst, cv::Size(src.rows/2,src.cols/2));
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCIE Downscale dst row : %d cols : %d", dst.rows,dst.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCIE Downscale dst row : %d cols : %d", dst.rows,dst.cols);
 }
 
 void upscaleAGCIE(const cv::Mat & src, cv::Mat & dst)
 {
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCIE Upscale src row : %d cols : %d", src.rows,src.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCIE Upscale src row : %d cols : %d", src.rows,src.cols);
     cv::resize(src, dst, cv::Size(src.rows*2,src.cols*2));
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCIE Upscale dst row : %d cols : %d", dst.rows,dst.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCIE Upscale dst row : %d cols : %d", dst.rows,dst.cols);
 }
\ No newline at end of file
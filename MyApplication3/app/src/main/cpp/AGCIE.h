@@ -1,6 +1,19 @@
+#include <array>
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include "EnhanceSession.h"
 
 void AGCIE(const cv::Mat& src, cv::Mat& dst);
+// histogramStep > 1 estimates the statistics from a sampled histogram (see Histogram.h).
+// CV_16U input is forwarded to AGCIE16() with `bitDepth` significant bits.
+void AGCIE(const cv::Mat& src, cv::Mat& dst, EnhanceBuffers& buffers, int histogramStep = 1, int bitDepth = 16);
+// Gamma table of AGCIE for the mean and standard deviation of V / 255.
+void AGCIETable(double mu, double sigma, std::array<uchar, 256>& table);
+// CV_16U input (1, 3 or 4 channels) holding `bitDepth`-bit samples, e.g. 10 or 12 bit camera
+// data or 16 bit PNGs: statistics from a 2^bitDepth-bin histogram and a table of the same
+// size, so nothing is quantised to 8 bits or expanded to float. dst has the type of src.
+// bitDepth must match the data: 10 bit samples read as 16 bit have almost all of the range
+// above them and come out as an underexposed image.
+void AGCIE16(const cv::Mat& src, cv::Mat& dst, int bitDepth);
 void upscaleAGCIE(const cv::Mat & src, cv::Mat & dst);
 void downscaleAGCIE(const cv::Mat & src, cv::Mat & dst);
@@ -1,83 +1,228 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
 #include "AGCWD.h"
-#include <android/log.h>
+#include "Histogram.h"
+#include "ValueGain.h"
+#include "ImageProcLog.h"
+#include "Trace.h"
 void AGCWD(const cv::Mat & src, cv::Mat & dst, double alpha)
 {
-    int rows = src.rows;
-    int cols = src.cols;
+    EnhanceBuffers buffers;
+    AGCWD(src, dst, buffers, alpha);
+}
+
+void AGCWD(const cv::Mat & src, cv::Mat & dst, EnhanceBuffers & buffers, double alpha, int histogramStep, int bitDepth)
+{
+    if (src.depth() == CV_16U) {
+        AGCWD16(src, dst, bitDepth, alpha);
+        return;
+    }
+    IMGPROC_TRACE_SCOPE("AGCWD");
     int channels = src.channels();
-    int total_pixels = rows * cols;
 
-    cv::Mat L;
-    cv::Mat HSV;
-    std::vector<cv::Mat> HSV_channels;
+    // Only the HSV value V = max(B, G, R) is enhanced, so its histogram is taken straight from
+    // the colour pixels and the LUT is applied by scaling them (see ValueGain.h).
+    Histogram256 hist;
     if (channels == 1) {
-        L = src.clone();
+        histogram256(src, hist, true, histogramStep);
     }
     else {
-        cv::cvtColor(src, HSV, cv::COLOR_BGR2HSV_FULL);
-        cv::split(HSV, HSV_channels);
-        L = HSV_channels[2];
+        histogramMaxRGB(src, hist, true, histogramStep);
     }
 
-    int histsize = 256;
-    float range[] = { 0,256 };
-    const float* histRanges = { range };
-    int bins = 256;
-    cv::Mat hist;
-    calcHist(&L, 1, 0, cv::Mat(), hist, 1, &histsize, &histRanges, true, false);
-
-    double total_pixels_inv = 1.0 / total_pixels;
-    cv::Mat PDF = cv::Mat::zeros(256, 1, CV_64F);
+    double total_pixels_inv = 1.0 / histogramCount(hist);
+    std::array<double, 256> PDF;
     for (int i = 0; i < 256; i++) {
-        PDF.at<double>(i) = hist.at<float>(i) * total_pixels_inv;
+        PDF[i] = hist[i] * total_pixels_inv;
     }
 
-    double pdf_min, pdf_max;
-    cv::minMaxLoc(PDF, &pdf_min, &pdf_max);
-    cv::Mat PDF_w = PDF.clone();
-    for (int i = 0; i < 256; i++) {
-        PDF_w.at<double>(i) = pdf_max * std::pow((PDF_w.at<double>(i) - pdf_min) / (pdf_max - pdf_min), alpha);
+    std::array<uchar, 256> table;
+    AGCWDTable(PDF, alpha, table);
+
+    if (channels == 1) {
+        cv::LUT(src, table, dst);
+    }
+    else {
+        // An RGBA dst (e.g. a locked bitmap) is written in place; anything else gets 3 channels.
+        applyValueLUT(src, dst, table);
     }
 
-    cv::Mat CDF_w = PDF_w.clone();
+    return;
+}
+
+// Fills table (same size as PDF) with the AGCWD curve over [0, maxValue].
+template<typename PDFType, typename Table>
+static void AGCWDCurve(const PDFType& PDF, double alpha, Table& table, double maxValue)
+{
+    typedef typename Table::value_type value_type;
+    const size_t levels = PDF.size();
+    double pdf_min = *std::min_element(PDF.begin(), PDF.end());
+    double pdf_max = *std::max_element(PDF.begin(), PDF.end());
+    PDFType CDF_w = PDF;
     double culsum = 0;
-    for (int i = 0; i < 256; i++) {
-        culsum += PDF_w.at<double>(i);
-        CDF_w.at<double>(i) = culsum;
+    for (size_t i = 0; i < levels; i++) {
+        culsum += pdf_max * std::pow((PDF[i] - pdf_min) / (pdf_max - pdf_min), alpha);
+        CDF_w[i] = culsum;
+    }
+    for (size_t i = 0; i < levels; i++) {
+        CDF_w[i] /= culsum;
+    }
+
+    table[0] = 0;
+    for (size_t i = 1; i < levels; i++) {
+        table[i] = cv::saturate_cast<value_type>(maxValue * std::pow((double)i / (levels - 1), 1 - CDF_w[i]));
     }
-    CDF_w /= culsum;
+}
 
-    std::vector<uchar> table(256, 0);
-    for (int i = 1; i < 256; i++) {
-        table[i] = cv::saturate_cast<uchar>(255.0 * std::pow(i / 255.0, 1 - CDF_w.at<double>(i)));
+void AGCWDTable(const std::array<double, 256>& PDF, double alpha, std::array<uchar, 256>& table)
+{
+    AGCWDCurve(PDF, alpha, table, 255.0);
+}
+
+void AGCWD16(const cv::Mat & src, cv::Mat & dst, int bitDepth, double alpha)
+{
+    IMGPROC_TRACE_SCOPE("AGCWD16");
+    CV_Assert( bitDepth >= 9 && bitDepth <= 16 );
+    const int maxValue = (1 << bitDepth) - 1;
+
+    std::vector<uint32_t> hist;
+    histogram16(src, hist, bitDepth);
+    const double inv = 1.0 / (double)src.total();
+    std::vector<double> PDF(hist.size());
+    for (size_t i = 0; i < hist.size(); i++) {
+        PDF[i] = hist[i] * inv;
     }
 
-    cv::LUT(L, table, L);
+    std::vector<ushort> table(hist.size());
+    AGCWDCurve(PDF, alpha, table, maxValue);
+    applyValueLUT16(src, dst, table);
+}
+
+void AGCWDLocal(const cv::Mat & src, cv::Mat & dst, int tiles, double alpha)
+{
+    IMGPROC_TRACE_SCOPE("AGCWDLocal");
+    CV_Assert( src.type() == CV_8UC1 || src.type() == CV_8UC3 || src.type() == CV_8UC4 );
+    CV_Assert( tiles >= 1 );
+    const int channels = src.channels();
+    // Tiles of fewer than 16 x 16 pixels have too few samples for a meaningful histogram.
+    const int tilesX = std::max(1, std::min(tiles, src.cols / 16));
+    const int tilesY = std::max(1, std::min(tiles, src.rows / 16));
+    const float tileW = (float)src.cols / tilesX;
+    const float tileH = (float)src.rows / tilesY;
+
+    // One AGCWD table per tile, built in parallel; stored as float for the interpolation.
+    std::vector<float> tables((size_t)tilesX * tilesY * 256);
+    cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range)
+    {
+        for (int t = range.start; t < range.end; t++)
+        {
+            const int tx = t % tilesX, ty = t / tilesX;
+            const int xBegin = tx * src.cols / tilesX, xEnd = (tx + 1) * src.cols / tilesX;
+            const int yBegin = ty * src.rows / tilesY, yEnd = (ty + 1) * src.rows / tilesY;
+            const cv::Mat tile = src(cv::Rect(xBegin, yBegin, xEnd - xBegin, yEnd - yBegin));
+
+            Histogram256 hist;
+            if (channels == 1) histogram256(tile, hist, false);
+            else histogramMaxRGB(tile, hist, false);
+            const double inv = 1.0 / histogramCount(hist);
+            std::array<double, 256> PDF;
+            for (int i = 0; i < 256; i++) PDF[i] = hist[i] * inv;
+
+            std::array<uchar, 256> table;
+            AGCWDTable(PDF, alpha, table);
+            float* out = &tables[(size_t)t * 256];
+            for (int i = 0; i < 256; i++) out[i] = table[i];
+        }
+    });
 
     if (channels == 1) {
-        dst = L.clone();
+        dst.create(src.size(), CV_8UC1);
     }
-    else {
-        cv::merge(HSV_channels, dst);
-        cv::cvtColor(dst, dst, cv::COLOR_HSV2BGR_FULL);
+    else if (dst.size() != src.size() || dst.type() != CV_8UC4) {
+        dst.create(src.size(), CV_8UC3);
     }
+    const int dcn = dst.channels();
 
-    return;
+    // Bilinear weights between tile centres, as in CLAHE. Pixels outside the outermost
+    // centres use the nearest tile.
+    std::vector<int> colTile0(src.cols), colTile1(src.cols);
+    std::vector<float> colWeight(src.cols);
+    for (int x = 0; x < src.cols; x++) {
+        float fx = (x + 0.5f) / tileW - 0.5f;
+        int t0 = (int)std::floor(fx);
+        colWeight[x] = fx - t0;
+        colTile0[x] = std::max(t0, 0);
+        colTile1[x] = std::min(t0 + 1, tilesX - 1);
+        if (t0 < 0) colWeight[x] = 0;
+        if (t0 + 1 > tilesX - 1) colWeight[x] = 0;
+    }
+
+    // One pass over the pixels: interpolate the four neighbouring tables at V and scale the
+    // pixel by the result / V, which keeps hue and saturation as in ValueGain.h.
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+        std::array<float, 256> inverse;
+        inverse[0] = 0;
+        for (int v = 1; v < 256; v++) inverse[v] = 1.0f / v;
+
+        for (int y = range.start; y < range.end; y++)
+        {
+            float fy = (y + 0.5f) / tileH - 0.5f;
+            int t0 = (int)std::floor(fy);
+            float wy = (t0 < 0 || t0 + 1 > tilesY - 1) ? 0.0f : fy - t0;
+            const float* rowTop = &tables[(size_t)std::max(t0, 0) * tilesX * 256];
+            const float* rowBottom = &tables[(size_t)std::min(t0 + 1, tilesY - 1) * tilesX * 256];
+
+            const uchar* s = src.ptr<uchar>(y);
+            uchar* d = dst.ptr<uchar>(y);
+            for (int x = 0; x < src.cols; x++, s += channels, d += dcn)
+            {
+                const int v = channels == 1 ? s[0] : std::max(s[0], std::max(s[1], s[2]));
+                const float wx = colWeight[x];
+                const int a = colTile0[x] * 256 + v, b = colTile1[x] * 256 + v;
+                const float top = rowTop[a] + wx * (rowTop[b] - rowTop[a]);
+                const float bottom = rowBottom[a] + wx * (rowBottom[b] - rowBottom[a]);
+                const float mapped = top + wy * (bottom - top);
+                if (channels == 1)
+                {
+                    d[0] = (uchar)(mapped + 0.5f);
+                    continue;
+                }
+                if (v == 0)
+                {
+                    d[0] = d[1] = d[2] = (uchar)(mapped + 0.5f);
+                }
+                else
+                {
+                    const float gain = mapped * inverse[v];
+                    d[0] = (uchar)std::min(255.0f, s[0] * gain + 0.5f);
+                    d[1] = (uchar)std::min(255.0f, s[1] * gain + 0.5f);
+                    d[2] = (uchar)std::min(255.0f, s[2] * gain + 0.5f);
+                }
+                if (dcn == 4)
+                {
+                    d[3] = channels == 4 ? s[3] : 255;
+                }
+            }
+        }
+    });
 }
 
 void downscaleAGCWD(const cv::Mat & src, cv::Mat & dst)
 {
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCWD Downscale src row : %d cols : %d", src.rows,src.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCWD Downscale src row : %d cols : %d", src.rows,src.cols);
     cv::resize(src, dst, cv::Size(src.rows/2,src.cols/2));
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCWD Downscale dst row : %d cols : %d", dst.rows,dst.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCWD Downscale dst row : %d cols : %d", dst.rows,dst.cols);
 }
 
 void upscaleAGCWD(const cv::Mat & src, cv::Mat & dst)
 {
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCWD Upscale src row : %d cols : %d", src.rows,src.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCWD Upscale src row : %d cols : %d", src.rows,src.cols);
     cv::resize(src, dst, cv::Size(src.rows*2,src.cols*2));
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] AGCWD Upscale dst row : %d cols : %d", dst.rows,dst.cols);
+    IMGPROC_LOGE(" [IMG_PROC] AGCWD Upscale dst row : %d cols : %d", dst.rows,dst.cols);
 }
\ No newline at end of file
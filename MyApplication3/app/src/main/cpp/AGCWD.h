@@ -1,6 +1,21 @@
+#include <array>
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include "EnhanceSession.h"
 
 void AGCWD(const cv::Mat& src, cv::Mat& dst, double alpha = 0.5);
+// histogramStep > 1 estimates the histogram by sampling (see Histogram.h). CV_16U input is
+// forwarded to AGCWD16() with `bitDepth` significant bits.
+void AGCWD(const cv::Mat& src, cv::Mat& dst, EnhanceBuffers& buffers, double alpha = 0.5, int histogramStep = 1,
+           int bitDepth = 16);
+// Gamma table of AGCWD for a normalised 256-bin histogram of the value plane.
+void AGCWDTable(const std::array<double, 256>& PDF, double alpha, std::array<uchar, 256>& table);
+// CV_16U input holding `bitDepth`-bit samples, with 2^bitDepth-bin histogram and table; see
+// AGCIE16().
+void AGCWD16(const cv::Mat& src, cv::Mat& dst, int bitDepth, double alpha = 0.5);
+// Local AGCWD: one table per tile of a tiles x tiles grid (fewer for small images), each
+// pixel mapped through a bilinear blend of its four nearest tile tables as in CLAHE. Brightens
+// dark regions of otherwise bright frames at close to LUT cost. dst follows AGCWD().
+void AGCWDLocal(const cv::Mat& src, cv::Mat& dst, int tiles = 8, double alpha = 0.5);
 void upscaleAGCWD(const cv::Mat & src, cv::Mat & dst);
 void downscaleAGCWD(const cv::Mat & src, cv::Mat & dst);
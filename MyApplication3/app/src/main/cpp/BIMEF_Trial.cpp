@@ -2,15 +2,37 @@
 #include "opencv2/core.hpp"
 #include <opencv2/opencv.hpp>
 #include "eigen/unsupported/Eigen/CXX11/Tensor"
+#include <algorithm>
 #include <array>
+#include <exception>
 #include <iostream>
+#include <memory>
 #include "BIMEF_Trial.h"
-#include <android/log.h>
+#include "ExposureEntropy.h"
+#include "FrameArena.h"
+#include "ImageProcLog.h"
+#include "SmoothingCG.h"
+#include "SmoothingMultigrid.h"
+#include "Trace.h"
+#include "WorkerPool.h"
 
 #ifndef HAVE_EIGEN
 #define HAVE_EIGEN
 #endif
 
+// What the illumination solve needs besides the image, handed from BIMEF_impl down.
+struct SmoothContext
+{
+    FrameArena& arena;
+    BIMEFSolver solver;
+    BIMEFStorage storage;
+    BIMEFWarmStart* warm;                            // video mode, may be null
+    std::shared_ptr<SmoothingMatrixCache>* cache;    // slot in EnhanceBuffers, may be null
+    int tileSize;                                    // > 0: tiled smoothing, see tsmoothTiled
+    std::vector<FrameArena>* tileArenas;             // per worker block, for tiled smoothing
+    bool periodic;                                   // false: Neumann boundary, for tiles
+};
+
 #ifdef HAVE_EIGEN
 #include "eigen/Eigen/Sparse"
 #include <opencv2/imgproc.hpp>
@@ -346,9 +368,9 @@ void cv2eigen( const Matx<_Tp, 1, _cols>& src,
     }
 }
 
+// srcVDiff and srcHDiff must be preallocated to the size of src.
 static void diff(const cv::Mat_<float>& src, Mat_<float>& srcVDiff, Mat_<float>& srcHDiff)
 {
-    srcVDiff = Mat_<float>(src.size());
     for (int i = 0; i < src.rows; i++)
     {
         if (i < src.rows - 1)
@@ -367,7 +389,6 @@ static void diff(const cv::Mat_<float>& src, Mat_<float>& srcVDiff, Mat_<float>&
         }
     }
 
-    srcHDiff = Mat_<float>(src.size());
     for (int j = 0; j < src.cols - 1; j++)
     {
         for (int i = 0; i < src.rows; i++)
@@ -381,22 +402,23 @@ static void diff(const cv::Mat_<float>& src, Mat_<float>& srcVDiff, Mat_<float>&
     }
 }
 
-static void computeTextureWeights(const Mat_<float>& x, float sigma, float sharpness, Mat_<float>& W_h, Mat_<float>& W_v)
+// W_h and W_v must be preallocated to the size of x.
+static void computeTextureWeights(const Mat_<float>& x, float sigma, float sharpness, Mat_<float>& W_h, Mat_<float>& W_v,
+                                  FrameArena& arena)
 {
-    Mat_<float> dt0_v, dt0_h;
+    IMGPROC_TRACE_SCOPE("computeTextureWeights");
+    Mat_<float> dt0_v = arena.mat<float>(x.size());
+    Mat_<float> dt0_h = arena.mat<float>(x.size());
     diff(x, dt0_v, dt0_h);
 
-    Mat_<float> gauker_h;
+    Mat_<float> gauker_h = arena.mat<float>(x.size());
     Mat_<float> kernel_h = Mat_<float>::ones(1, static_cast<int>(sigma));
     filter2D(dt0_h, gauker_h, -1, kernel_h, Point(-1, -1), 0, BORDER_CONSTANT);
 
-    Mat_<float> gauker_v;
+    Mat_<float> gauker_v = arena.mat<float>(x.size());
     Mat_<float> kernel_v = Mat_<float>::ones(static_cast<int>(sigma), 1);
     filter2D(dt0_v, gauker_v, -1, kernel_v, Point(-1, -1), 0, BORDER_CONSTANT);
 
-    W_h = Mat_<float>(gauker_h.size());
-    W_v = Mat_<float>(gauker_v.size());
-
     for (int i = 0; i < gauker_h.rows; i++)
     {
         for (int j = 0; j < gauker_h.cols; j++)
@@ -407,153 +429,279 @@ static void computeTextureWeights(const Mat_<float>& x, float sigma, float sharp
     }
 }
 
-template <class numeric_t>
-static Eigen::SparseMatrix<numeric_t> spdiags(const Eigen::Matrix<numeric_t, -1, -1>& B,
-                                              const Eigen::VectorXi& d, int m, int n) {
-    typedef Eigen::Triplet<numeric_t> triplet_t;
-    std::vector<triplet_t> triplets;
-    triplets.reserve(static_cast<size_t>(std::min(m, n) * d.size()));
+typedef Eigen::Map<Eigen::VectorXf> ArenaVectorXf;
 
-    for (int k = 0; k < d.size(); ++k) {
-        int diag = d(k);  // get diagonal
-        int i_start = std::max(-diag, 0); // get row of 1st element
-        int i_end = std::min(m, m - diag - (m - n)); // get row of last element
-        int j = -std::min(0, -diag); // get col of 1st element
-        int B_i; // start index i in matrix B
-        if (m < n) {
-            B_i = std::max(-diag, 0); // m < n
-        }
-        else {
-            B_i = std::max(0, diag); // m >= n
-        }
-        for (int i = i_start; i < i_end; ++i, ++j, ++B_i) {
-            triplets.push_back({ i, j,  B(B_i,k) });
-        }
+// Incomplete-Cholesky CG together with its matrix, kept per image size in EnhanceBuffers. The
+// sparsity pattern of the system and the fill-reducing ordering only depend on the size, so
+// after the first frame of a size only the values are rewritten and the factor recomputed.
+// IncompleteCholesky only reads the lower triangle, so only that is stored.
+struct SmoothingMatrixCache
+{
+    SmoothingMatrixCache()
+    {
+        cg.setTolerance(0.1f);
+        cg.setMaxIterations(50);
     }
-    Eigen::SparseMatrix<numeric_t> A(m, n);
-    A.setFromTriplets(triplets.begin(), triplets.end());
-    return A;
-}
 
+    cv::Size size;
+    Eigen::SparseMatrix<float> A;
+    Eigen::ConjugateGradient<Eigen::SparseMatrix<float>, Eigen::Lower, Eigen::IncompleteCholesky<float> > cg;
+};
 
-static Mat solveLinearEquation(const Mat_<float>& img, Mat_<float>& W_h_, Mat_<float>& W_v_, float lambda)
+// Runs an Eigen CG solver set up for the system, starting from `guess` when there is one
+// (column-major like tin) and from zero otherwise. Returns the iterations taken.
+template<typename Solver>
+static int runCG(Solver& cg, const Eigen::Map<const Eigen::VectorXf>& tin, const float* guess, ArenaVectorXf& x)
 {
-    Eigen::MatrixXf W_h;
-    cv2eigen(W_h_, W_h);
-    Eigen::MatrixXf tempx(W_h.rows(), W_h.cols());
-    tempx.block(0, 1, tempx.rows(), tempx.cols() - 1) = W_h.block(0, 0, W_h.rows(), W_h.cols() - 1);
-    for (Eigen::Index i = 0; i < tempx.rows(); i++)
     {
-        tempx(i, 0) = W_h(i, W_h.cols() - 1);
+        IMGPROC_TRACE_SCOPE("cg.solve");
+        if (guess) {
+            x = cg.solveWithGuess(tin, Eigen::Map<const Eigen::VectorXf>(guess, tin.size()));
+        } else {
+            x = cg.solve(tin);
+        }
     }
+    IMGPROC_TRACE_COUNTER("cg.iterations", cg.iterations());
+    IMGPROC_TRACE_COUNTER("cg.error", cg.error());
+    return (int)cg.iterations();
+}
 
-    Eigen::MatrixXf W_v;
-    cv2eigen(W_v_, W_v);
-    Eigen::MatrixXf tempy(W_v.rows(), W_v.cols());
-    tempy.block(1, 0, tempx.rows() - 1, tempx.cols()) = W_v.block(0, 0, W_v.rows() - 1, W_v.cols());
-    for (Eigen::Index j = 0; j < tempy.cols(); j++)
+// The same for SmoothingCG, which works on the arrays directly.
+template<typename Preconditioner>
+static int runCG(SmoothingCG<Preconditioner>& cg, const Eigen::Map<const Eigen::VectorXf>& tin, const float* guess,
+                 ArenaVectorXf& x)
+{
     {
-        tempy(0, j) = W_v(W_v.rows() - 1, j);
+        IMGPROC_TRACE_SCOPE("cg.solve");
+        cg.solve(tin.data(), guess, x.data());
     }
+    IMGPROC_TRACE_COUNTER("cg.iterations", cg.iterations());
+    IMGPROC_TRACE_COUNTER("cg.error", cg.error());
+    return cg.iterations();
+}
 
+// Assembles the sparse system and solves it with incomplete-Cholesky CG. Reference for the
+// matrix-free path below. x receives the solution in column-major pixel order.
+static int solveAssembled(const Mat_<float>& W_h, const Mat_<float>& W_v, float lambda,
+                          const Eigen::Map<const Eigen::VectorXf>& tin, const float* guess, ArenaVectorXf& x,
+                          const SmoothContext& ctx)
+{
+    std::shared_ptr<SmoothingMatrixCache> cachePtr = ctx.cache ? *ctx.cache : nullptr;
+    if (!cachePtr) {
+        cachePtr = std::make_shared<SmoothingMatrixCache>();
+        if (ctx.cache) *ctx.cache = cachePtr;
+    }
+    SmoothingMatrixCache& cache = *cachePtr;
+    const bool samePattern = cache.size == W_h.size();
 
-    Eigen::VectorXf dx(W_h.rows() * W_h.cols());
-    Eigen::VectorXf dy(W_v.rows() * W_v.cols());
-
-    Eigen::VectorXf dxa(tempx.rows() * tempx.cols());
-    Eigen::VectorXf dya(tempy.rows() * tempy.cols());
-
-    //Flatten in a col-major order
-    for (Eigen::Index j = 0; j < W_h.cols(); j++)
     {
-        for (Eigen::Index i = 0; i < W_h.rows(); i++)
-        {
-            dx(j * W_h.rows() + i) = -lambda * W_h(i, j);
-            dy(j * W_h.rows() + i) = -lambda * W_v(i, j);
-
-            dxa(j * W_h.rows() + i) = -lambda * tempx(i, j);
-            dya(j * W_h.rows() + i) = -lambda * tempy(i, j);
-        }
+        IMGPROC_TRACE_SCOPE("solveLinearEquation.assemble");
+        SmoothingOperator op;
+        op.setWeights(W_h, W_v, lambda, ctx.arena, ctx.periodic);
+        op.assemble(cache.A, true, samePattern);
+    }
+    if (!samePattern) {
+        IMGPROC_TRACE_SCOPE("cg.analyzePattern");
+        cache.cg.analyzePattern(cache.A);
+        cache.size = W_h.size();
     }
-
-    tempx.setZero();
-    tempx.col(0) = W_h.col(W_h.cols() - 1);
-
-    tempy.setZero();
-    tempy.row(0) = W_v.row(W_v.rows() - 1);
-
-    W_h.col(W_h.cols() - 1).setZero();
-    W_v.row(W_v.rows() - 1).setZero();
-
-    Eigen::VectorXf dxd1(tempx.rows() * tempx.cols());
-    Eigen::VectorXf dyd1(tempy.rows() * tempy.cols());
-    Eigen::VectorXf dxd2(W_h.rows() * W_h.cols());
-    Eigen::VectorXf dyd2(W_v.rows() * W_v.cols());
-
-    //Flatten in a col-major order
-    for (Eigen::Index j = 0; j < tempx.cols(); j++)
     {
-        for (Eigen::Index i = 0; i < tempx.rows(); i++)
-        {
-            dxd1(j * tempx.rows() + i) = -lambda * tempx(i, j);
-            dyd1(j * tempx.rows() + i) = -lambda * tempy(i, j);
+        IMGPROC_TRACE_SCOPE("cg.factorize");
+        cache.cg.factorize(cache.A);
+    }
+    return runCG(cache.cg, tin, guess, x);
+}
 
-            dxd2(j * tempx.rows() + i) = -lambda * W_h(i, j);
-            dyd2(j * tempx.rows() + i) = -lambda * W_v(i, j);
-        }
+// Same system through SmoothingOperator: no assembly. With Jacobi, CG needs more iterations
+// than with incomplete Cholesky for the same tolerance (about 1.5x on camera frames), but
+// each one is a single streaming sweep and there is no factorisation. A multigrid V-cycle as
+// preconditioner brings it down to a handful of iterations at any resolution.
+static int solveMatrixFree(const Mat_<float>& W_h, const Mat_<float>& W_v, float lambda,
+                           const Eigen::Map<const Eigen::VectorXf>& tin, const float* guess, ArenaVectorXf& x,
+                           FrameArena& arena, BIMEFSolver solver, bool periodic)
+{
+    SmoothingOperator A;
+    {
+        IMGPROC_TRACE_SCOPE("solveLinearEquation.assemble");
+        A.setWeights(W_h, W_v, lambda, arena, periodic);
     }
 
-    Eigen::MatrixXf dxd(dxd1.rows(), dxd1.cols() + dxd2.cols());
-    dxd << dxd1, dxd2;
+    if (solver == BIMEF_SOLVER_MULTIGRID) {
+        SmoothingCG<SmoothingMultigridPreconditioner> cg;
+        cg.setTolerance(0.1f);
+        cg.setMaxIterations(50);
+        cg.setArena(arena);
+        cg.preconditioner().setArena(arena);
+        cg.compute(A);
+        return runCG(cg, tin, guess, x);
+    }
 
-    Eigen::MatrixXf dyd(dyd1.rows(), dyd1.cols() + dyd2.cols());
-    dyd << dyd1, dyd2;
+    SmoothingCG<SmoothingJacobi> cg;
+    cg.setTolerance(0.1f);
+    cg.setMaxIterations(200);
+    cg.setArena(arena);
+    cg.compute(A);
+    return runCG(cg, tin, guess, x);
+}
 
-    const int k = img.rows * img.cols;
+// tout must be preallocated to the size of img. With `warm`, the previous frame's solution
+// of the same size is the starting point of CG, and this frame's solution replaces it.
+static void solveLinearEquation(const Mat_<float>& img, Mat_<float>& W_h, Mat_<float>& W_v, float lambda,
+                                Mat_<float>& tout, const SmoothContext& ctx)
+{
+    IMGPROC_TRACE_SCOPE("solveLinearEquation");
+    FrameArena& arena = ctx.arena;
+    BIMEFWarmStart* warm = ctx.warm;
     const int r = img.rows;
-    Eigen::Matrix<int, 2, 1> diagx_idx;
-    diagx_idx << -k + r, -r;
-    Eigen::SparseMatrix<float> Ax = spdiags(dxd, diagx_idx, k, k);
-
-    Eigen::Matrix<int, 2, 1> diagy_idx;
-    diagy_idx << -r + 1, -1;
-    Eigen::SparseMatrix<float> Ay = spdiags(dyd, diagy_idx, k, k);
-
-    Eigen::MatrixXf D = (dx + dy + dxa + dya);
-    D = Eigen::MatrixXf::Ones(D.rows(), D.cols()) - D;
+    const int c = img.cols;
+    const int k = r * c;
+
+    // The system numbers pixels column by column.
+    Mat_<float> img_t = arena.mat<float>(c, r);
+    transpose(img, img_t);
+    Eigen::Map<const Eigen::VectorXf> tin(img_t.ptr<float>(), k);
+    ArenaVectorXf x(arena.allocate<float>(k), k);
+
+    const float* guess = nullptr;
+    if (warm && warm->size == img.size() && !warm->illumination.empty()) {
+        guess = warm->illumination.data();
+    }
 
-    Eigen::Matrix<int, 1, 1> diag_idx_zero;
-    diag_idx_zero << 0;
-    Eigen::SparseMatrix<float> A = (Ax + Ay) + Eigen::SparseMatrix<float>((Ax + Ay).transpose()) + spdiags(D, diag_idx_zero, k, k);
+    int iterations;
+    if (ctx.solver == BIMEF_SOLVER_IC) {
+        iterations = solveAssembled(W_h, W_v, lambda, tin, guess, x, ctx);
+    } else {
+        iterations = solveMatrixFree(W_h, W_v, lambda, tin, guess, x, arena, ctx.solver, ctx.periodic);
+    }
 
-    //CG solver of Eigen
-    Eigen::ConjugateGradient<Eigen::SparseMatrix<float>, Eigen::Lower | Eigen::Upper, Eigen::IncompleteCholesky<float> > cg;
-    cg.setTolerance(0.1f);
-    cg.setMaxIterations(50);
-    cg.compute(A);
-    Mat_<float> img_t = img.t();
-    Eigen::Map<const Eigen::VectorXf> tin(img_t.ptr<float>(), img_t.rows * img_t.cols);
-    Eigen::VectorXf x = cg.solve(tin);
+    if (warm) {
+        warm->illumination.assign(x.data(), x.data() + k);
+        warm->size = img.size();
+        warm->iterations = iterations;
+    }
 
-    Mat_<float> tout(img.rows, img.cols);
     tout.forEach(
             [&](float& pixel, const int* position) -> void
             {
                 pixel = x(position[1] * img.rows + position[0]);
             }
     );
+}
+
+static void tsmoothTiled(const Mat_<float>& src, Mat_<float>& S, const SmoothContext& ctx, float lambda, float sigma,
+                         float sharpness);
+
+// S must be preallocated to the size of src.
+static void tsmooth(const Mat_<float>& src, Mat_<float>& S, const SmoothContext& ctx,
+                    float lambda = 0.01f, float sigma = 3.0f, float sharpness = 0.001f)
+{
+    if (ctx.tileSize > 0 && (src.rows > ctx.tileSize || src.cols > ctx.tileSize))
+    {
+        tsmoothTiled(src, S, ctx, lambda, sigma, sharpness);
+        return;
+    }
+    FrameArena& arena = ctx.arena;
+    Mat_<float> W_h = arena.mat<float>(src.size());
+    Mat_<float> W_v = arena.mat<float>(src.size());
+    computeTextureWeights(src, sigma, sharpness, W_h, W_v, arena);
 
-    return tout;
+    solveLinearEquation(src, W_h, W_v, lambda, S, ctx);
 }
 
-static Mat_<float> tsmooth(const Mat_<float>& src, float lambda = 0.01f, float sigma = 3.0f, float sharpness = 0.001f)
+// Overlap of neighbouring tiles on each side of their common border, at most a quarter of
+// the tile size. The smoothing only carries illumination a few dozen pixels at these lambdas,
+// so beyond that the tiles agree with the whole-image solution.
+static const int kTileMargin = 32;
+
+// Splits [0, length) into `count` cores of near-equal size: core t is [bounds[t], bounds[t + 1]).
+static void tileBounds(int length, int count, int* bounds)
 {
-    Mat_<float> W_h, W_v;
-    computeTextureWeights(src, sigma, sharpness, W_h, W_v);
+    for (int t = 0; t <= count; t++) bounds[t] = (int)((long long)length * t / count);
+}
 
-    Mat_<float> S = solveLinearEquation(src, W_h, W_v, lambda);
+// Cross-fade weight of tile t at coordinate x: ramps over the 2 * margin pixels around each
+// border shared with another tile, so the weights of two neighbours add up to one.
+static float tileWeight(const int* bounds, int count, int t, int margin, int x)
+{
+    if (t > 0 && x < bounds[t] + margin) return (x - (bounds[t] - margin) + 0.5f) / (2 * margin);
+    if (t < count - 1 && x >= bounds[t + 1] - margin) return 1 - (x - (bounds[t + 1] - margin) + 0.5f) / (2 * margin);
+    return 1;
+}
 
-    return S;
+// tsmooth on overlapping tiles of at most ctx.tileSize (plus margins), so the memory and the
+// size of each system are bounded by the tile size whatever the image size, and the tiles
+// are solved in parallel. Each tile is smoothed on its own with a Neumann boundary, so its
+// edges do not wrap around to the opposite side of the tile, and the results are cross-faded
+// over the overlaps. Tiles run in
+// four phases by row and column parity: tiles of one phase never overlap, so they add into S
+// without locking. Every worker block reuses its own arena from ctx.tileArenas.
+static void tsmoothTiled(const Mat_<float>& src, Mat_<float>& S, const SmoothContext& ctx, float lambda, float sigma,
+                         float sharpness)
+{
+    IMGPROC_TRACE_SCOPE("tsmoothTiled");
+    FrameArena& arena = ctx.arena;
+    const int tilesY = (src.rows + ctx.tileSize - 1) / ctx.tileSize;
+    const int tilesX = (src.cols + ctx.tileSize - 1) / ctx.tileSize;
+    const int margin = std::min(kTileMargin, ctx.tileSize / 4);
+    int* ys = arena.allocate<int>(tilesY + 1);
+    int* xs = arena.allocate<int>(tilesX + 1);
+    tileBounds(src.rows, tilesY, ys);
+    tileBounds(src.cols, tilesX, xs);
+    int* phaseTiles = arena.allocate<int>((size_t)tilesY * tilesX);
+
+    std::vector<FrameArena> localArenas;
+    std::vector<FrameArena>& tileArenas = ctx.tileArenas ? *ctx.tileArenas : localArenas;
+    if ((int)tileArenas.size() < workerPool().NumThreads()) tileArenas.resize(workerPool().NumThreads());
+    std::vector<std::exception_ptr> errors(tileArenas.size());
+
+    S.setTo(0);
+    for (int phase = 0; phase < 4; phase++)
+    {
+        int n = 0;
+        for (int ty = phase >> 1; ty < tilesY; ty += 2)
+        {
+            for (int tx = phase & 1; tx < tilesX; tx += 2) phaseTiles[n++] = ty * tilesX + tx;
+        }
+
+        parallelFor(n, 1, [&](int block, int begin, int end)
+        {
+            FrameArena& tileArena = tileArenas[block];
+            SmoothContext tileCtx = { tileArena, ctx.solver, ctx.storage, NULL, NULL, 0, NULL, false };
+            try {
+                for (int t = begin; t < end; t++)
+                {
+                    const int ty = phaseTiles[t] / tilesX, tx = phaseTiles[t] % tilesX;
+                    const int y0 = std::max(0, ys[ty] - margin), y1 = std::min(src.rows, ys[ty + 1] + margin);
+                    const int x0 = std::max(0, xs[tx] - margin), x1 = std::min(src.cols, xs[tx + 1] + margin);
+                    const Rect rect(x0, y0, x1 - x0, y1 - y0);
+
+                    tileArena.reset();
+                    Mat_<float> tile = tileArena.mat<float>(rect.size());
+                    src(rect).copyTo(tile);
+                    Mat_<float> smooth = tileArena.mat<float>(rect.size());
+                    tsmooth(tile, smooth, tileCtx, lambda, sigma, sharpness);
+
+                    for (int i = 0; i < rect.height; i++)
+                    {
+                        const float wy = tileWeight(ys, tilesY, ty, margin, y0 + i);
+                        const float* in = smooth[i];
+                        float* out = S[y0 + i] + x0;
+                        for (int j = 0; j < rect.width; j++)
+                        {
+                            out[j] += wy * tileWeight(xs, tilesX, tx, margin, x0 + j) * in[j];
+                        }
+                    }
+                }
+            } catch (...) {
+                errors[block] = std::current_exception();
+            }
+        });
+
+        for (std::exception_ptr& e : errors)
+        {
+            if (e) std::rethrow_exception(e);
+        }
+    }
 }
 
 static Mat_<float> rgb2gm(const Mat_<Vec3f>& I)
@@ -569,52 +717,13 @@ static Mat_<float> rgb2gm(const Mat_<Vec3f>& I)
     return gm;
 }
 
-static Mat_<float> applyK(const Mat_<float>& I, float k, float a = -0.3293f, float b = 1.1258f) {
+// J must be preallocated to the size of I.
+static void applyK(const Mat_<Vec3f>& I, Mat_<Vec3f>& J, float k, float a = -0.3293f, float b = 1.1258f, float offset = 0) {
     float beta = std::exp((1 - std::pow(k, a)) * b);
     float gamma = std::pow(k, a);
 
-    Mat_<float> J(I.size());
     pow(I, gamma, J);
-    J = J * beta;
-
-    return J;
-}
-
-static Mat_<Vec3f> applyK(const Mat_<Vec3f>& I, float k, float a = -0.3293f, float b = 1.1258f, float offset = 0) {
-    float beta = std::exp((1 - std::pow(k, a)) * b);
-    float gamma = std::pow(k, a);
-
-    Mat_<Vec3f> J(I.size());
-    pow(I, gamma, J);
-
-    return J * beta + Scalar::all(offset);
-}
-
-static float entropy(const Mat_<float>& I)
-{
-    Mat_<uchar> I_uchar;
-    I.convertTo(I_uchar, CV_8U, 255);
-
-    std::vector<Mat> planes;
-    planes.push_back(I_uchar);
-    Mat_<float> hist;
-    const int histSize = 256;
-    float range[] = { 0, 256 };
-    const float* histRange = { range };
-    calcHist(&I_uchar, 1, NULL, Mat(), hist, 1, &histSize, &histRange);
-
-    Mat_<float> hist_norm = hist / cv::sum(hist)[0];
-
-    float E = 0;
-    for (int i = 0; i < hist_norm.rows; i++)
-    {
-        if (hist_norm(i, 0) > 0)
-        {
-            E += hist_norm(i, 0) * std::log2(hist_norm(i, 0));
-        }
-    }
-
-    return -E;
+    J.convertTo(J, -1, beta, offset);
 }
 
 template <typename T> static int sgn(T val)
@@ -622,9 +731,10 @@ template <typename T> static int sgn(T val)
     return (T(0) < val) - (val < T(0));
 }
 
-static double minimize_scalar_bounded(const Mat_<float>& I, double begin, double end,
-                                      double xatol = 1e-4, int maxiter = 500)
+static double minimize_scalar_bounded(const Mat_<float>& I, double begin, double end, float responseA,
+                                      float responseB, double xatol = 1e-4, int maxiter = 500)
 {
+    IMGPROC_TRACE_SCOPE("minimize_scalar_bounded");
     // From scipy: https://github.com/scipy/scipy/blob/v1.4.1/scipy/optimize/optimize.py#L1753-L1894
     //    """
     //    Options
@@ -640,6 +750,7 @@ static double minimize_scalar_bounded(const Mat_<float>& I, double begin, double
     //    xatol : float
     //        Absolute error in solution `xopt` acceptable for convergence.
     //    """
+    ExposureEntropy entropy(I, responseA, responseB);
     double x1 = begin, x2 = end;
 
     if (x1 > x2) {
@@ -653,7 +764,7 @@ static double minimize_scalar_bounded(const Mat_<float>& I, double begin, double
     double nfc = fulc, xf = fulc;
     double rat = 0.0, e = 0.0;
     double x = xf;
-    double fx = -entropy(applyK(I, static_cast<float>(x)));
+    double fx = -entropy(x);
     int num = 1;
     double fu = std::numeric_limits<double>::infinity();
 
@@ -668,8 +779,8 @@ static double minimize_scalar_bounded(const Mat_<float>& I, double begin, double
         // Check for parabolic fit
         if (std::abs(e) > tol1) {
             golden = 0;
-            double r = (xf - nfc) * (-entropy(applyK(I, static_cast<float>(x))) - ffulc);
-            double q = (xf - fulc) * (-entropy(applyK(I, static_cast<float>(x))) - fnfc);
+            double r = (xf - nfc) * (-entropy(x) - ffulc);
+            double q = (xf - fulc) * (-entropy(x) - fnfc);
             double p = (xf - fulc) * q - (xf - nfc) * r;
             q = 2.0 * (q - r);
 
@@ -708,7 +819,7 @@ static double minimize_scalar_bounded(const Mat_<float>& I, double begin, double
 
         double si = sgn(rat) + (rat == 0);
         x = xf + si * std::max(std::abs(rat), tol1);
-        fu = -entropy(applyK(I, static_cast<float>(x)));
+        fu = -entropy(x);
         num += 1;
 
         if (fu <= fx) {
@@ -754,16 +865,17 @@ static double minimize_scalar_bounded(const Mat_<float>& I, double begin, double
     return xf;
 }
 
-static Mat_<Vec3f> maxEntropyEnhance(const Mat_<Vec3f>& I, const Mat_<uchar>& isBad, float a, float b)
-{
-    Mat_<Vec3f> input;
-    resize(I, input, Size(50, 50));
+// With `warm`, k is only searched within kWarmSearchRadius of the previous frame's value (it
+// still follows a changing scene, by up to that much per frame), and the result is kept.
+static const double kWarmSearchRadius = 0.5;
 
+// Exposure ratio that maximises the entropy of the badly exposed pixels (isBad) of I, both
+// already reduced to 50x50. Returns 0 when no pixel is bad.
+static float maxEntropyK(const Mat_<Vec3f>& input, const Mat_<uchar>& isBad_resize, float a, float b,
+                         BIMEFWarmStart* warm)
+{
     Mat_<float> Y = rgb2gm(input);
 
-    Mat_<uchar> isBad_resize;
-    resize(isBad, isBad_resize, Size(50, 50));
-
     std::vector<float> Y_vec;
     for (int i = 0; i < isBad_resize.rows; i++)
     {
@@ -778,18 +890,119 @@ static Mat_<Vec3f> maxEntropyEnhance(const Mat_<Vec3f>& I, const Mat_<uchar>& is
 
     if (Y_vec.empty())
     {
-        return I;
+        return 0;
     }
 
     Mat_<float> Y_mat(static_cast<int>(Y_vec.size()), 1, Y_vec.data());
-    float opt_k = static_cast<float>(minimize_scalar_bounded(Y_mat, 1, 7));
+    double begin = 1, end = 7;
+    if (warm && warm->k > 0) {
+        begin = std::max(begin, warm->k - kWarmSearchRadius);
+        end = std::min(end, warm->k + kWarmSearchRadius);
+    }
+    float opt_k = static_cast<float>(minimize_scalar_bounded(Y_mat, begin, end, a, b));
+    if (warm) {
+        warm->k = opt_k;
+    }
+    return opt_k;
+}
+
+// J must be preallocated to the size of I.
+static void maxEntropyEnhance(const Mat_<Vec3f>& I, const Mat_<uchar>& isBad, float a, float b, Mat_<Vec3f>& J,
+                              BIMEFWarmStart* warm)
+{
+    IMGPROC_TRACE_SCOPE("maxEntropyEnhance");
+    Mat_<Vec3f> input;
+    resize(I, input, Size(50, 50));
 
-    return applyK(I, opt_k, a, b, -0.01f);
+    Mat_<uchar> isBad_resize;
+    resize(isBad, isBad_resize, Size(50, 50));
+
+    float opt_k = maxEntropyK(input, isBad_resize, a, b, warm);
+    if (opt_k == 0)
+    {
+        I.copyTo(J);
+        return;
+    }
+
+    applyK(I, J, opt_k, a, b, -0.01f);
+}
+
+// BIMEF_STORAGE_HALF counterparts of the above. The enhanced image only depends on the 8-bit
+// input value, so J is written through a 256-entry table (computed in float) and stored in
+// half; k is estimated on the 8-bit input reduced to 50x50.
+static void applyKHalf(const cv::Mat& input, cv::Mat& J, float k, float a, float b, float offset, bool clamp)
+{
+    const float beta = std::exp((1 - std::pow(k, a)) * b);
+    const float gamma = std::pow(k, a);
+    cv::float16_t table[256];
+    for (int v = 0; v < 256; v++)
+    {
+        float value = beta * std::pow(v / 255.0f, gamma) + offset;
+        table[v] = cv::float16_t(clamp ? std::min(1.0f, value) : value);
+    }
+    parallel_for_(Range(0, input.rows), [&](const Range& range)
+    {
+        for (int i = range.start; i < range.end; i++)
+        {
+            const uchar* src = input.ptr<uchar>(i);
+            cv::float16_t* dst = J.ptr<cv::float16_t>(i);
+            for (int j = 0; j < input.cols * 3; j++) dst[j] = table[src[j]];
+        }
+    });
+}
+
+static void maxEntropyEnhanceHalf(const cv::Mat& input, const cv::Mat& imgHalf, const Mat_<uchar>& isBad, float a,
+                                  float b, cv::Mat& J, BIMEFWarmStart* warm)
+{
+    IMGPROC_TRACE_SCOPE("maxEntropyEnhance");
+    cv::Mat small8;
+    resize(input, small8, Size(50, 50));
+    Mat_<Vec3f> small;
+    small8.convertTo(small, CV_32F, 1 / 255.0);
+
+    Mat_<uchar> isBad_resize;
+    resize(isBad, isBad_resize, Size(50, 50));
+
+    float opt_k = maxEntropyK(small, isBad_resize, a, b, warm);
+    if (opt_k == 0)
+    {
+        J = imgHalf;
+        return;
+    }
+
+    applyKHalf(input, J, opt_k, a, b, -0.01f, false);
+}
+
+static inline float toFloat(float v) { return v; }
+static inline float toFloat(cv::float16_t v) { return (float)v; }
+
+// out = img * w + J * (1 - w) for one row of 3-channel pixels; cn is 3 or 4 (opaque alpha).
+template<typename T>
+static void blendRow(const T* img, const T* J, const float* W, uchar* pixel, int cols, int cn)
+{
+    for (int j = 0; j < cols; j++, img += 3, J += 3, pixel += cn)
+    {
+        float w = W[j];
+        pixel[0] = saturate_cast<uchar>((toFloat(img[0]) * w + toFloat(J[0]) * (1 - w)) * 255);
+        pixel[1] = saturate_cast<uchar>((toFloat(img[1]) * w + toFloat(J[1]) * (1 - w)) * 255);
+        pixel[2] = saturate_cast<uchar>((toFloat(img[2]) * w + toFloat(J[2]) * (1 - w)) * 255);
+        if (cn == 4)
+        {
+            pixel[3] = 255;
+        }
+    }
 }
 
+// Smoothing parameters of the illumination map.
+static const float kIlluminationLambda = 0.5f;
+static const float kIlluminationSigma = 5;
+
 //static void BIMEF_impl(InputArray input_, OutputArray output_, float mu, float* k, float a, float b)
-static void BIMEF_impl(const cv::Mat& input, cv::Mat& output, float mu, float* k, float a, float b)
+// Every full- and half-resolution temporary comes from `arena`, which is reset on entry.
+static void BIMEF_impl(const cv::Mat& input, cv::Mat& output, float mu, float* k, float a, float b,
+                       const SmoothContext& ctx)
 {
+    FrameArena& arena = ctx.arena;
     //CV_INSTRUMENT_REGION()
     //Mat input = input_.getMat();
     if (input.empty())
@@ -797,32 +1010,64 @@ static void BIMEF_impl(const cv::Mat& input, cv::Mat& output, float mu, float* k
         return;
     }
     CV_CheckTypeEQ(input.type(), CV_8UC3, "Input image must be 8-bits color image (CV_8UC3).");
+    IMGPROC_TRACE_SCOPE("BIMEF_impl");
+    arena.reset();
+    // Half storage keeps the full-resolution 3-channel maps (the image and J) in IEEE half,
+    // converted back to float where they are read. The single-channel maps share one float
+    // buffer instead: t_b is dead once downscaled, so t_our and then W are written over it.
+    const bool half = ctx.storage == BIMEF_STORAGE_HALF;
+    IMGPROC_TRACE_BEGIN(illumination);
     Mat_<Vec3f> imgDouble;
-    input.convertTo(imgDouble, CV_32F, 1 / 255.0);
+    cv::Mat imgHalf;
     // t: scene illumination map
-    Mat_<float> t_b(imgDouble.size());
-    t_b.forEach(
-            [&](float& pixel, const int* position) -> void
-            {
-                pixel = std::max(std::max(imgDouble(position[0], position[1])[0],
-                                          imgDouble(position[0], position[1])[1]),
-                                 imgDouble(position[0], position[1])[2]);
-            }
-    );
-    const float lambda = 0.5;
-    const float sigma = 5;
-
-    Mat_<float> t_b_resize;
-    resize(t_b, t_b_resize, Size(), 0.5, 0.5);
-    Mat_<float> t_our = tsmooth(t_b_resize, lambda, sigma);
+    Mat_<float> t_b = arena.mat<float>(input.size());
+    if (half)
+    {
+        imgHalf = cv::Mat(input.size(), CV_16FC3, arena.allocate<cv::float16_t>(input.total() * 3));
+        input.convertTo(imgHalf, CV_16F, 1 / 255.0);
+        t_b.forEach(
+                [&](float& pixel, const int* position) -> void
+                {
+                    const Vec3b& v = input.at<Vec3b>(position[0], position[1]);
+                    pixel = std::max(std::max(v[0], v[1]), v[2]) * (1 / 255.0f);
+                }
+        );
+    }
+    else
+    {
+        imgDouble = arena.mat<Vec3f>(input.size());
+        input.convertTo(imgDouble, CV_32F, 1 / 255.0);
+        t_b.forEach(
+                [&](float& pixel, const int* position) -> void
+                {
+                    pixel = std::max(std::max(imgDouble(position[0], position[1])[0],
+                                              imgDouble(position[0], position[1])[1]),
+                                     imgDouble(position[0], position[1])[2]);
+                }
+        );
+    }
+    IMGPROC_TRACE_END(illumination, "illuminationMap");
+
+    IMGPROC_TRACE_BEGIN(smooth);
+    // Same size as resize(..., Size(), 0.5, 0.5) would pick.
+    Size half_size(saturate_cast<int>(t_b.cols * 0.5), saturate_cast<int>(t_b.rows * 0.5));
+    Mat_<float> t_b_resize = arena.mat<float>(half_size);
+    resize(t_b, t_b_resize, half_size);
+    Mat_<float> t_our_resize = arena.mat<float>(half_size);
+    tsmooth(t_b_resize, t_our_resize, ctx, kIlluminationLambda, kIlluminationSigma);
     //Mat_<float> t_our = t_b_resize;
-    resize(t_our, t_our, t_b.size());
+    Mat_<float> t_our = half ? t_b : arena.mat<float>(t_b.size());
+    resize(t_our_resize, t_our, t_b.size());
+    IMGPROC_TRACE_END(smooth, "tsmooth");
 
     // k: exposure ratio
     Mat_<Vec3f> J;
+    cv::Mat JHalf;
+    if (half) JHalf = cv::Mat(input.size(), CV_16FC3, arena.allocate<cv::float16_t>(input.total() * 3));
+    else J = arena.mat<Vec3f>(input.size());
     if (k == NULL)
     {
-        Mat_<uchar> isBad(t_our.size());
+        Mat_<uchar> isBad = arena.mat<uchar>(t_our.size());
         isBad.forEach(
                 [&](uchar& pixel, const int* position) -> void
                 {
@@ -830,11 +1075,18 @@ static void BIMEF_impl(const cv::Mat& input, cv::Mat& output, float mu, float* k
                 }
         );
 
-        J = maxEntropyEnhance(imgDouble, isBad, a, b);
+        if (half) maxEntropyEnhanceHalf(input, imgHalf, isBad, a, b, JHalf, ctx.warm);
+        else maxEntropyEnhance(imgDouble, isBad, a, b, J, ctx.warm);
+    }
+    else if (half)
+    {
+        IMGPROC_TRACE_SCOPE("applyK");
+        applyKHalf(input, JHalf, *k, a, b, 0, true);
     }
     else
     {
-        J = applyK(imgDouble, *k, a, b);
+        IMGPROC_TRACE_SCOPE("applyK");
+        applyK(imgDouble, J, *k, a, b);
 
         // fix overflow
         J.forEach(
@@ -847,55 +1099,118 @@ static void BIMEF_impl(const cv::Mat& input, cv::Mat& output, float mu, float* k
         );
     }
     // W: Weight Matrix
-    Mat_<float> W(t_our.size());
+    IMGPROC_TRACE_SCOPE("blend");
+    Mat_<float> W = half ? t_our : arena.mat<float>(t_our.size());
     pow(t_our, mu, W);
 
     //output_.create(input.size(), CV_8UC3);
-    output = Mat::zeros( input.size(), CV_8UC3 );
+    // An RGBA output (e.g. a locked bitmap) is filled in place with opaque alpha.
+    if (output.size() != input.size() || output.type() != CV_8UC4)
+    {
+        output.create(input.size(), CV_8UC3);
+    }
     //Mat output = output_.getMat();
-    output.forEach<Vec3b>(
-            [&](Vec3b& pixel, const int* position) -> void
+    const int cn = output.channels();
+    parallel_for_(Range(0, output.rows), [&](const Range& range)
+    {
+        for (int i = range.start; i < range.end; i++)
+        {
+            if (half)
             {
-                float w = W(position[0], position[1]);
-                pixel(0) = saturate_cast<uchar>((imgDouble(position[0], position[1])[0] * w + J(position[0], position[1])[0] * (1 - w)) * 255);
-                pixel(1) = saturate_cast<uchar>((imgDouble(position[0], position[1])[1] * w + J(position[0], position[1])[1] * (1 - w)) * 255);
-                pixel(2) = saturate_cast<uchar>((imgDouble(position[0], position[1])[2] * w + J(position[0], position[1])[2] * (1 - w)) * 255);
+                blendRow(imgHalf.ptr<cv::float16_t>(i), JHalf.ptr<cv::float16_t>(i), W[i], output.ptr<uchar>(i),
+                         output.cols, cn);
             }
-    );
+            else
+            {
+                blendRow(imgDouble.ptr<float>(i), J.ptr<float>(i), W[i], output.ptr<uchar>(i), output.cols, cn);
+            }
+        }
+    });
+}
+
+void BIMEFIllumination(const cv::Mat& input, Mat_<float>& t, EnhanceBuffers& buffers, BIMEFSolver solver, int tileSize)
+{
+    CV_Assert( input.type() == CV_8UC3 || input.type() == CV_8UC4 );
+    FrameArena& arena = buffers.arena;
+    arena.reset();
+    const int cn = input.channels();
+    Mat_<float> t_b = arena.mat<float>(input.size());
+    for (int i = 0; i < input.rows; i++)
+    {
+        const uchar* p = input.ptr<uchar>(i);
+        float* out = t_b[i];
+        for (int j = 0; j < input.cols; j++, p += cn) out[j] = std::max(std::max(p[0], p[1]), p[2]) * (1 / 255.0f);
+    }
+    Size half_size(saturate_cast<int>(t_b.cols * 0.5), saturate_cast<int>(t_b.rows * 0.5));
+    Mat_<float> t_b_resize = arena.mat<float>(half_size);
+    resize(t_b, t_b_resize, half_size);
+
+    t.create(half_size);
+    SmoothContext ctx = { arena, solver, BIMEF_STORAGE_FLOAT, NULL, &buffers.smoothingCache, tileSize,
+                          &buffers.tileArenas, true };
+    tsmooth(t_b_resize, t, ctx, kIlluminationLambda, kIlluminationSigma);
 }
 #else
-static void BIMEF_impl(cv::InputArray, cv::OutputArray, float, float*, float, float)
+static void BIMEF_impl(const cv::Mat&, cv::Mat&, float, float*, float, float, const SmoothContext&)
 {
     std::cout << "This algorithm requires OpenCV built with the Eigen library." << std::endl;
 
 }
+
+void BIMEFIllumination(const cv::Mat&, cv::Mat_<float>&, EnhanceBuffers&, BIMEFSolver, int)
+{
+    std::cout << "This algorithm requires OpenCV built with the Eigen library." << std::endl;
+}
 #endif
 
 void  BIMEF(const cv::Mat& input, cv::Mat& output, float mu , float a , float b )//;BIMEF(InputArray input, OutputArray output, float mu, float a, float b)
 {
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Reached BIMEF  mu a b : %f %f %f", mu,a,b);
-    cv::Mat temp;
-    cv::cvtColor(input,temp,cv::COLOR_BGRA2BGR);
-    BIMEF_impl(temp, output, mu, NULL, a, b);
+    EnhanceBuffers buffers;
+    BIMEF(input, output, buffers, mu, a, b);
+}
+
+void  BIMEF(const cv::Mat& input, cv::Mat& output, EnhanceBuffers& buffers, float mu , float a , float b ,
+            BIMEFSolver solver, BIMEFStorage storage, int tileSize)
+{
+    BIMEF(input, output, buffers, NULL, mu, a, b, solver, storage, tileSize);
+}
+
+void  BIMEF(const cv::Mat& input, cv::Mat& output, EnhanceBuffers& buffers, BIMEFWarmStart* warm, float mu , float a ,
+            float b , BIMEFSolver solver, BIMEFStorage storage, int tileSize)
+{
+    IMGPROC_LOGE(" [IMG_PROC] Reached BIMEF  mu a b : %f %f %f", mu,a,b);
+    cv::Mat temp = input;
+    if (input.channels() == 4)
+    {
+        cv::cvtColor(input,buffers.BGR,cv::COLOR_BGRA2BGR);
+        temp = buffers.BGR;
+    }
+    SmoothContext ctx = { buffers.arena, solver, storage, warm, &buffers.smoothingCache, tileSize,
+                          &buffers.tileArenas, true };
+    BIMEF_impl(temp, output, mu, NULL, a, b, ctx);
+    IMGPROC_TRACE_COUNTER("bimef.arenaPeakBytes", buffers.arena.peakBytes());
+    IMGPROC_LOGE(" [IMG_PROC] BIMEF temporaries peak : %d KB", (int)(buffers.arena.peakBytes() / 1024));
 }
 
 void BIMEF(const cv::Mat& input, cv::Mat& output, float k, float mu, float a, float b)
 {
-    BIMEF_impl(input, output, mu, &k, a, b);
+    FrameArena arena;
+    SmoothContext ctx = { arena, BIMEF_SOLVER_IC, BIMEF_STORAGE_FLOAT, NULL, NULL, 0, NULL, true };
+    BIMEF_impl(input, output, mu, &k, a, b, ctx);
 }
 
 void downscaleBIMEF(const cv::Mat & src, cv::Mat & dst)
 {
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] BIMEF Downscale src row : %d cols : %d", src.rows,src.cols);
+    IMGPROC_LOGE(" [IMG_PROC] BIMEF Downscale src row : %d cols : %d", src.rows,src.cols);
     cv::resize(src, dst, cv::Size(src.rows/2,src.cols/2));
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] BIMEF Downscale dst row : %d cols : %d", dst.rows,dst.cols);
+    IMGPROC_LOGE(" [IMG_PROC] BIMEF Downscale dst row : %d cols : %d", dst.rows,dst.cols);
 }
 
 void upscaleBIMEF(const cv::Mat & src, cv::Mat & dst)
 {
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] BIMEF Upscale src row : %d cols : %d", src.rows,src.cols);
+    IMGPROC_LOGE(" [IMG_PROC] BIMEF Upscale src row : %d cols : %d", src.rows,src.cols);
     cv::resize(src, dst, cv::Size(src.rows*2,src.cols*2));
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] BIMEF Upscale dst row : %d cols : %d", dst.rows,dst.cols);
+    IMGPROC_LOGE(" [IMG_PROC] BIMEF Upscale dst row : %d cols : %d", dst.rows,dst.cols);
 }
 
 
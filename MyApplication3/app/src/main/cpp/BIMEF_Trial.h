@@ -1,7 +1,45 @@
+#pragma once
+
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include "EnhanceSession.h"
+
+// Linear solver of the illumination smoothing step. All of them stop at the same loose
+// tolerance, so the preconditioner shows in the result: the matrix-free solvers are faster but
+// give a slightly different illumination map and output. IC, which gives the original
+// results, is the default; the others are opted into per call or per pipeline (BIMEF:multigrid,
+// see Pipeline.h). imageproc_bench reports their output difference to IC.
+enum BIMEFSolver
+{
+    BIMEF_SOLVER_IC = 0,          // assembled sparse matrix, incomplete-Cholesky CG
+    BIMEF_SOLVER_MATRIX_FREE,     // stencil operator (SmoothingOperator.h), Jacobi CG
+    BIMEF_SOLVER_MULTIGRID,       // stencil operator, CG preconditioned by a multigrid V-cycle
+};
+
+// Storage of the full-resolution intermediate maps. Half keeps the float image and its
+// enhanced version in IEEE half (computing in float) and reuses one buffer for t, t_our and W:
+// 17 instead of 37 bytes of temporaries per pixel, and 16 instead of 28 bytes read per pixel by
+// the blend, for small output differences (measured by BIMEF/half in imageproc_bench).
+enum BIMEFStorage
+{
+    BIMEF_STORAGE_FLOAT = 0,
+    BIMEF_STORAGE_HALF,
+};
 
 void  BIMEF(const cv::Mat& input, cv::Mat& output, float mu = 0.5f, float a = -0.3293f, float b = 1.1258f);
+// tileSize > 0 smooths the (half-resolution) illumination map in overlapping tiles of about
+// that size, solved in parallel; memory then no longer grows with the size of the system.
+void  BIMEF(const cv::Mat& input, cv::Mat& output, EnhanceBuffers& buffers, float mu = 0.5f, float a = -0.3293f, float b = 1.1258f,
+            BIMEFSolver solver = BIMEF_SOLVER_IC, BIMEFStorage storage = BIMEF_STORAGE_FLOAT,
+            int tileSize = 0);
+// Video mode: starts from and updates `warm` (may be null), see StreamingBIMEF.h.
+void  BIMEF(const cv::Mat& input, cv::Mat& output, EnhanceBuffers& buffers, BIMEFWarmStart* warm, float mu = 0.5f,
+            float a = -0.3293f, float b = 1.1258f, BIMEFSolver solver = BIMEF_SOLVER_IC,
+            BIMEFStorage storage = BIMEF_STORAGE_FLOAT, int tileSize = 0);
 void BIMEF(const cv::Mat& input, cv::Mat& output, float k, float mu, float a, float b);
+// The smoothed illumination map t of BIMEF for a CV_8UC3 or CV_8UC4 input, at the half
+// resolution it is solved at, for comparing solvers and tiling (see imageproc_bench).
+void BIMEFIllumination(const cv::Mat& input, cv::Mat_<float>& t, EnhanceBuffers& buffers,
+                       BIMEFSolver solver = BIMEF_SOLVER_IC, int tileSize = 0);
 void upscaleBIMEF(const cv::Mat & src, cv::Mat & dst);
-void downscaleBIMEF(const cv::Mat & src, cv::Mat & dst);
\ No newline at end of file
+void downscaleBIMEF(const cv::Mat & src, cv::Mat & dst);
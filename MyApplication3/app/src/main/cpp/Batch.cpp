@@ -0,0 +1,40 @@
+#include <chrono>
+#include <exception>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "Batch.h"
+#include "Enhance.h"
+#include "WorkerPool.h"
+
+std::vector<double> enhanceBatch(int algorithm, const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs)
+{
+    checkPoolAlgorithm(algorithm);
+    const size_t n = inputs.size();
+    outputs.resize(n);
+    std::vector<double> timings(n, 0.0);
+    std::vector<std::exception_ptr> errors(n);
+    if (n == 0) return timings;
+
+    Eigen::Barrier barrier(static_cast<unsigned int>(n));
+    for (size_t i = 0; i < n; i++) {
+        workerPool().Schedule([&, i]() {
+            try {
+                auto start = std::chrono::high_resolution_clock::now();
+                enhance(algorithm, inputs[i], outputs[i], workerSession());
+                auto end = std::chrono::high_resolution_clock::now();
+                timings[i] = std::chrono::duration<double, std::milli>(end - start).count();
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+            trimSession(workerSession(), kWorkerSessionBytes);
+            barrier.Notify();
+        });
+    }
+    barrier.Wait();
+
+    for (size_t i = 0; i < n; i++) {
+        if (errors[i]) std::rethrow_exception(errors[i]);
+    }
+    return timings;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Enhances every image of `inputs` with `algorithm` (an EnhanceAlgorithm id), scheduling the
+// images across the worker pool. outputs[i] follows the rules of enhance(): an RGBA Mat of
+// the right size is written in place. Returns the processing time of each image in
+// milliseconds. Must not be called from a worker pool thread. The stream algorithms are
+// rejected, see checkPoolAlgorithm().
+std::vector<double> enhanceBatch(int algorithm, const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs);
@@ -0,0 +1,88 @@
+#include <string>
+#include <opencv2/core.hpp>
+
+#include "Enhance.h"
+#include "AGCIE.h"
+#include "AGCWD.h"
+#include "BIMEF_Trial.h"
+#include "Pipeline.h"
+
+const char* enhanceAlgorithmName(int algorithm)
+{
+    switch (algorithm) {
+        case ENHANCE_AGCIE: return "AGCIE";
+        case ENHANCE_AGCWD: return "AGCWD";
+        case ENHANCE_BIMEF: return "BIMEF";
+        case ENHANCE_AGCIE_DSUS: return "AGCIEDSUS";
+        case ENHANCE_AGCWD_DSUS: return "AGCWDDSUS";
+        case ENHANCE_BIMEF_DSUS: return "BIMEFDSUS";
+        case ENHANCE_AGCWD_STREAM: return "AGCWDSTREAM";
+        case ENHANCE_AGCWD_LOCAL: return "AGCWDLOCAL";
+        case ENHANCE_BIMEF_STREAM: return "BIMEFSTREAM";
+        default: return "unknown";
+    }
+}
+
+// Pipeline descriptions of the downscale / enhance / upscale variants.
+static const char* dsusPipeline(int algorithm)
+{
+    switch (algorithm) {
+        case ENHANCE_AGCIE_DSUS: return "downscale|AGCIE|upscale";
+        case ENHANCE_AGCWD_DSUS: return "downscale|AGCWD|upscale";
+        case ENHANCE_BIMEF_DSUS: return "downscale|BIMEF|upscale";
+        default: return nullptr;
+    }
+}
+
+void checkPoolAlgorithm(int algorithm)
+{
+    if (algorithm == ENHANCE_AGCWD_STREAM || algorithm == ENHANCE_BIMEF_STREAM) {
+        CV_Error(cv::Error::StsBadArg, std::string(enhanceAlgorithmName(algorithm)) +
+                 " keeps state across frames and must run on the caller's session");
+    }
+}
+
+void trimSession(EnhanceSession& session, size_t maxBytes)
+{
+    EnhanceBuffers& buffers = session.buffers;
+    size_t bytes = buffers.arena.capacity() + buffers.BGR.total() * buffers.BGR.elemSize();
+    for (const FrameArena& arena : buffers.tileArenas) bytes += arena.capacity();
+    if (bytes <= maxBytes) return;
+
+    buffers.arena.release();
+    buffers.tileArenas.clear();
+    buffers.smoothingCache.reset();
+    buffers.BGR.release();
+    session.pipeline.reset();
+}
+
+void enhance(int algorithm, const cv::Mat& src, cv::Mat& dst, EnhanceSession& session, int bitDepth)
+{
+    switch (algorithm) {
+        case ENHANCE_AGCIE:
+            AGCIE(src, dst, session.buffers, 1, bitDepth);
+            break;
+        case ENHANCE_AGCWD:
+            AGCWD(src, dst, session.buffers, 0.5, 1, bitDepth);
+            break;
+        case ENHANCE_BIMEF:
+            BIMEF(src, dst, session.buffers);
+            break;
+        case ENHANCE_AGCIE_DSUS:
+        case ENHANCE_AGCWD_DSUS:
+        case ENHANCE_BIMEF_DSUS:
+            sessionPipeline(session, dsusPipeline(algorithm)).run(src, dst, session);
+            break;
+        case ENHANCE_AGCWD_STREAM:
+            session.agcwdStream.process(src, dst);
+            break;
+        case ENHANCE_AGCWD_LOCAL:
+            AGCWDLocal(src, dst);
+            break;
+        case ENHANCE_BIMEF_STREAM:
+            session.bimefStream.process(src, dst, session.buffers);
+            break;
+        default:
+            CV_Error(cv::Error::StsBadArg, "Unknown enhancement algorithm");
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include "EnhanceSession.h"
+
+// Algorithm ids shared by the asynchronous, batch and command-line entry points.
+// Keep in sync with the ALGORITHM_* constants in MainActivity.java (which leaves out the
+// stream ids, see checkPoolAlgorithm).
+enum EnhanceAlgorithm
+{
+    ENHANCE_AGCIE = 0,
+    ENHANCE_AGCWD = 1,
+    ENHANCE_BIMEF = 2,
+    ENHANCE_AGCIE_DSUS = 3,
+    ENHANCE_AGCWD_DSUS = 4,
+    ENHANCE_BIMEF_DSUS = 5,
+    ENHANCE_AGCWD_STREAM = 6,   // temporal AGCWD, state kept in the session
+    ENHANCE_AGCWD_LOCAL = 7,    // tiled AGCWD, see AGCWDLocal()
+    ENHANCE_BIMEF_STREAM = 8,   // warm-started BIMEF, state kept in the session
+    ENHANCE_ALGORITHM_COUNT
+};
+
+const char* enhanceAlgorithmName(int algorithm);
+
+// Throws StsBadArg for the algorithms that keep state in the session across frames (the
+// stream modes). The pool entry points (submitAsync jobs, enhanceBatch) run on per-thread
+// sessions, in no particular order, so that state would be split between threads and each
+// frame would continue from some other thread's last frame.
+void checkPoolAlgorithm(int algorithm);
+
+// Frees the scratch memory of `session` (arenas, buffers, cached pipeline and solver
+// structures) when the arenas and buffers hold more than maxBytes together. Meant for sessions
+// that see unrelated frames, like those of the worker pool threads, so that one large frame
+// does not keep its peak reserved on every thread it ever ran on.
+void trimSession(EnhanceSession& session, size_t maxBytes);
+
+// Runs one enhancement algorithm using the buffers of `session`. An RGBA dst of the right
+// size is written in place, otherwise dst gets 3 channels. bitDepth is the number of
+// significant bits of CV_16U input (AGCIE and AGCWD only, see AGCIE16).
+void enhance(int algorithm, const cv::Mat& src, cv::Mat& dst, EnhanceSession& session, int bitDepth = 16);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "FrameArena.h"
+#include "StreamingAGCWD.h"
+#include "StreamingBIMEF.h"
+
+class Pipeline;
+struct SmoothingMatrixCache;
+
+// Scratch images used inside the enhancement algorithms. Keeping one of these alive across
+// calls lets cv::Mat::create() reuse the allocations as long as the resolution does not change.
+struct EnhanceBuffers
+{
+    cv::Mat BGR;
+    FrameArena arena;   // BIMEF temporaries, reset at the start of every run
+    std::shared_ptr<SmoothingMatrixCache> smoothingCache;   // BIMEF's IC solver structure for the last size
+    std::vector<FrameArena> tileArenas;                     // BIMEF tiled smoothing, one per worker block
+};
+
+// Native state that the Java side creates once and keeps by handle, so that steady-state
+// processing of same-sized frames does no heap allocation. A session must only be used by
+// one call at a time.
+struct EnhanceSession
+{
+    EnhanceBuffers buffers;
+    std::shared_ptr<Pipeline> pipeline;   // last pipeline run on this session, see sessionPipeline()
+    StreamingAGCWD agcwdStream;           // state of ENHANCE_AGCWD_STREAM across frames
+    StreamingBIMEF bimefStream;           // state of ENHANCE_BIMEF_STREAM across frames
+};
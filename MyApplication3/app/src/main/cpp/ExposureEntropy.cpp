@@ -0,0 +1,56 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ExposureEntropy.h"
+
+ExposureEntropy::ExposureEntropy(const cv::Mat_<float>& I, float a, float b) : samples(I.begin(), I.end()), a(a), b(b)
+{
+    std::sort(samples.begin(), samples.end());
+}
+
+float ExposureEntropy::operator()(double k)
+{
+    for (const std::pair<double, float>& known : evaluated)
+    {
+        if (known.first == k) return known.second;
+    }
+
+    const float kf = static_cast<float>(k);
+    const float gamma = std::pow(kf, a);
+    const float beta = std::exp((1 - gamma) * b);
+    // Output level of a sample, computed like applyK and the 8-bit conversion do.
+    auto level = [&](float v) -> int
+    {
+        return cv::saturate_cast<uchar>(std::pow(v, gamma) * beta * 255);
+    };
+    // below[l]: samples whose level is below l. The threshold 255 * beta * v^gamma = l - 0.5
+    // is solved for v, and samples within rounding distance of it are checked with
+    // level(), so every sample gets the level the direct evaluation would give it.
+    size_t below[257];
+    below[0] = 0;
+    below[256] = samples.size();
+    for (int l = 1; l < 256; l++)
+    {
+        const float threshold = (float)std::pow((l - 0.5) / (255.0 * beta), 1.0 / gamma);
+        const float lo = threshold * (1 - 1e-4f), hi = threshold * (1 + 1e-4f);
+        size_t n = std::lower_bound(samples.begin() + below[l - 1], samples.end(), threshold) - samples.begin();
+        while (n > below[l - 1] && samples[n - 1] >= lo && level(samples[n - 1]) >= l) n--;
+        while (n < samples.size() && samples[n] <= hi && level(samples[n]) < l) n++;
+        below[l] = n;
+    }
+
+    const float total = (float)samples.size();
+    float E = 0;
+    for (int l = 0; l < 256; l++)
+    {
+        const size_t count = below[l + 1] - below[l];
+        if (count > 0)
+        {
+            float p = count / total;
+            E += p * std::log2(p);
+        }
+    }
+
+    evaluated.push_back(std::make_pair(k, -E));
+    return -E;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Entropy of the 8-bit quantisation of BIMEF's applyK(I, k, a, b), as a function of k. applyK is increasing in the value, so the samples landing in output level l are those
+// between two thresholds, found by binary search in the samples sorted once: an evaluation
+// costs 256 pow and binary searches instead of a pass over I with pow, conversion and
+// histogram. Values already evaluated are remembered, since the minimiser asks again for the
+// last point.
+class ExposureEntropy
+{
+public:
+    // a and b are the camera response parameters passed to BIMEF().
+    ExposureEntropy(const cv::Mat_<float>& I, float a, float b);
+
+    float operator()(double k);
+
+private:
+    std::vector<float> samples;
+    float a, b;
+    std::vector<std::pair<double, float> > evaluated;
+};
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "FrameArena.h"
+
+static const size_t kArenaAlignment = 64;
+static const size_t kMinBlockSize = 1 << 20;
+
+static size_t alignUp(size_t n)
+{
+    return (n + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+}
+
+void FrameArena::addBlock(size_t size)
+{
+    Block block;
+    block.size = size;
+    block.storage.reset(new uchar[size + kArenaAlignment]);
+    block.data = reinterpret_cast<uchar*>(alignUp(reinterpret_cast<uintptr_t>(block.storage.get())));
+    blocks.push_back(std::move(block));
+    offset = 0;
+}
+
+void FrameArena::reset()
+{
+    // A frame that spilled into several blocks gets one block big enough for all of it.
+    if (blocks.size() > 1) {
+        blocks.clear();
+        addBlock(used);
+    }
+    offset = 0;
+    used = 0;
+}
+
+void FrameArena::release()
+{
+    blocks.clear();
+    offset = 0;
+    used = 0;
+}
+
+void* FrameArena::allocate(size_t bytes)
+{
+    bytes = alignUp(std::max<size_t>(bytes, 1));
+    if (blocks.empty() || offset + bytes > blocks.back().size) {
+        size_t grow = blocks.empty() ? 0 : capacity();
+        addBlock(std::max(bytes, std::max(grow, kMinBlockSize)));
+    }
+    void* p = blocks.back().data + offset;
+    offset += bytes;
+    used += bytes;
+    return p;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t total = 0;
+    for (const Block& block : blocks) total += block.size;
+    return total;
+}
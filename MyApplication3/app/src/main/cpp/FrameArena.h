@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Bump allocator for the temporaries of one frame. Memory handed out stays valid until the
+// next reset() and is never freed individually. When a frame outgrows the current block,
+// more blocks are chained; the next reset() replaces them with a single block of the
+// previous peak size, so repeated frames of one resolution stop touching the heap.
+class FrameArena
+{
+public:
+    FrameArena() : offset(0), used(0) {}
+    FrameArena(FrameArena&&) = default;
+    FrameArena& operator=(FrameArena&&) = default;
+
+    // Starts a new frame; everything allocated before becomes invalid.
+    void reset();
+    // Like reset(), and gives the memory back to the heap.
+    void release();
+
+    // 64-byte aligned, uninitialised storage.
+    void* allocate(size_t bytes);
+
+    template<typename T> T* allocate(size_t count)
+    {
+        return static_cast<T*>(allocate(count * sizeof(T)));
+    }
+
+    // Uninitialised matrix whose pixels live in the arena. OpenCV functions given it as an
+    // output of the same size and type write into it instead of reallocating.
+    template<typename T> cv::Mat_<T> mat(int rows, int cols)
+    {
+        return cv::Mat_<T>(rows, cols, allocate<T>((size_t)rows * cols));
+    }
+
+    template<typename T> cv::Mat_<T> mat(cv::Size size)
+    {
+        return mat<T>(size.height, size.width);
+    }
+
+    // Bytes handed out since the last reset(); nothing is freed in between, so this is also
+    // the frame's peak.
+    size_t peakBytes() const { return used; }
+    // Bytes currently reserved from the heap.
+    size_t capacity() const;
+
+private:
+    struct Block
+    {
+        std::unique_ptr<uchar[]> storage;
+        uchar* data;   // storage rounded up to the alignment
+        size_t size;
+    };
+
+    void addBlock(size_t size);
+
+    std::vector<Block> blocks;
+    size_t offset;   // first free byte in blocks.back()
+    size_t used;
+};
+
+// std::allocator replacement so that standard containers (e.g. triplet lists) can live in a
+// FrameArena. deallocate() is a no-op; the memory comes back on the next reset().
+template<typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+    template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return arena->allocate<T>(n); }
+    void deallocate(T*, size_t) {}
+
+    template<typename U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template<typename U> bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+    FrameArena* arena;
+};
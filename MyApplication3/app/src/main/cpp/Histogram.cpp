@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "Histogram.h"
+
+// Below this many counted pixels the thread hand-off costs more than the counting.
+static const int kParallelMinPixels = 1 << 18;
+
+// Every stripe counts into kBanks interleaved sub-histograms, so a run of equal values
+// increments four different counters instead of stalling on one store-to-load chain.
+static const int kBanks = 4;
+static const int kBankedSize = kBanks * 256;
+static const size_t kCacheLine = 64;
+
+static inline uchar maxRGB(const uchar* p)
+{
+    return std::max(p[0], std::max(p[1], p[2]));
+}
+
+static void countRows(const cv::Mat& src, int begin, int end, uint32_t* banks)
+{
+    uint32_t* b0 = banks;
+    uint32_t* b1 = banks + 256;
+    uint32_t* b2 = banks + 512;
+    uint32_t* b3 = banks + 768;
+    const int cols = src.cols;
+    for (int i = begin; i < end; i++) {
+        const uchar* row = src.ptr<uchar>(i);
+        int j = 0;
+        for (; j + 4 <= cols; j += 4) {
+            b0[row[j]]++;
+            b1[row[j + 1]]++;
+            b2[row[j + 2]]++;
+            b3[row[j + 3]]++;
+        }
+        for (; j < cols; j++) {
+            b0[row[j]]++;
+        }
+    }
+}
+
+static void countMaxRows(const cv::Mat& src, int begin, int end, uint32_t* banks)
+{
+    uint32_t* b0 = banks;
+    uint32_t* b1 = banks + 256;
+    uint32_t* b2 = banks + 512;
+    uint32_t* b3 = banks + 768;
+    const int cols = src.cols;
+    const int cn = src.channels();
+    for (int i = begin; i < end; i++) {
+        const uchar* p = src.ptr<uchar>(i);
+        int j = 0;
+        for (; j + 4 <= cols; j += 4, p += 4 * cn) {
+            b0[maxRGB(p)]++;
+            b1[maxRGB(p + cn)]++;
+            b2[maxRGB(p + 2 * cn)]++;
+            b3[maxRGB(p + 3 * cn)]++;
+        }
+        for (; j < cols; j++, p += cn) {
+            b0[maxRGB(p)]++;
+        }
+    }
+}
+
+static inline uint32_t blockHash(uint32_t bi, uint32_t bj)
+{
+    uint32_t h = bi * 0x9E3779B1u ^ (bj + 0x7F4A7C15u) * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+// One pixel out of every step x step block of block rows [begin, end).
+static void countSampledBlocks(const cv::Mat& src, int step, int begin, int end, uint32_t* banks)
+{
+    const int cn = src.channels();
+    int bank = 0;
+    for (int bi = begin; bi < end; bi++) {
+        const int y0 = bi * step;
+        const int bh = std::min(step, src.rows - y0);
+        for (int x0 = 0, bj = 0; x0 < src.cols; x0 += step, bj++) {
+            const int bw = std::min(step, src.cols - x0);
+            const uint32_t h = blockHash(bi, bj);
+            const uchar* p = src.ptr<uchar>(y0 + (int)((h & 0xFFFF) % bh)) + (x0 + (int)((h >> 16) % bw)) * cn;
+            banks[bank * 256 + (cn == 1 ? p[0] : maxRGB(p))]++;
+            bank = (bank + 1) & (kBanks - 1);
+        }
+    }
+}
+
+// Counts `units` rows (or block rows) with count(begin, end, banks). Large jobs are split into
+// one stripe per thread, each with private banks starting on their own cache line, and all
+// banks are summed at the end.
+template<typename Count>
+static void countStripes(int units, size_t pixels, Histogram256& hist, bool parallel, Count count)
+{
+    int stripes = std::min(cv::getNumThreads(), units);
+    if (!parallel || pixels < (size_t)kParallelMinPixels) stripes = 1;
+    stripes = std::max(stripes, 1);
+
+    const size_t alignWords = kCacheLine / sizeof(uint32_t);
+    std::vector<uint32_t> storage((size_t)stripes * kBankedSize + alignWords, 0);
+    uint32_t* banks = storage.data();
+    banks += (alignWords - (reinterpret_cast<uintptr_t>(banks) / sizeof(uint32_t)) % alignWords) % alignWords;
+
+    if (stripes == 1) {
+        count(0, units, banks);
+    }
+    else {
+        cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range)
+        {
+            for (int s = range.start; s < range.end; s++)
+            {
+                count(units * s / stripes, units * (s + 1) / stripes, banks + (size_t)s * kBankedSize);
+            }
+        }, stripes);
+    }
+
+    hist.fill(0);
+    for (int s = 0; s < stripes * kBanks; s++) {
+        const uint32_t* bank = banks + (size_t)s * 256;
+        for (int i = 0; i < 256; i++) hist[i] += bank[i];
+    }
+}
+
+static void histogramImpl(const cv::Mat& src, Histogram256& hist, bool parallel, int step, bool maxRGB)
+{
+    CV_Assert( step >= 1 );
+    if (step == 1) {
+        countStripes(src.rows, src.total(), hist, parallel, [&](int begin, int end, uint32_t* banks) {
+            if (maxRGB) countMaxRows(src, begin, end, banks);
+            else countRows(src, begin, end, banks);
+        });
+        return;
+    }
+    const int blockRows = (src.rows + step - 1) / step;
+    const int blockCols = (src.cols + step - 1) / step;
+    countStripes(blockRows, (size_t)blockRows * blockCols, hist, parallel, [&](int begin, int end, uint32_t* banks) {
+        countSampledBlocks(src, step, begin, end, banks);
+    });
+}
+
+void histogram256(const cv::Mat& src, Histogram256& hist, bool parallel, int step)
+{
+    CV_Assert( src.type() == CV_8UC1 );
+    histogramImpl(src, hist, parallel, step, false);
+}
+
+void histogramMaxRGB(const cv::Mat& src, Histogram256& hist, bool parallel, int step)
+{
+    CV_Assert( src.type() == CV_8UC3 || src.type() == CV_8UC4 );
+    histogramImpl(src, hist, parallel, step, true);
+}
+
+static void countRows16(const cv::Mat& src, int begin, int end, int maxValue, uint32_t* hist)
+{
+    const int cols = src.cols;
+    const int cn = src.channels();
+    for (int i = begin; i < end; i++) {
+        const ushort* p = src.ptr<ushort>(i);
+        for (int j = 0; j < cols; j++, p += cn) {
+            int v = cn == 1 ? p[0] : std::max(p[0], std::max(p[1], p[2]));
+            hist[std::min(v, maxValue)]++;
+        }
+    }
+}
+
+void histogram16(const cv::Mat& src, std::vector<uint32_t>& hist, int bitDepth, bool parallel)
+{
+    CV_Assert( src.depth() == CV_16U && (src.channels() == 1 || src.channels() == 3 || src.channels() == 4) );
+    CV_Assert( bitDepth >= 1 && bitDepth <= 16 );
+    const int bins = 1 << bitDepth;
+    hist.assign(bins, 0);
+
+    int stripes = std::min(cv::getNumThreads(), src.rows);
+    if (!parallel || src.total() < (size_t)kParallelMinPixels) stripes = 1;
+    if (stripes <= 1) {
+        countRows16(src, 0, src.rows, bins - 1, hist.data());
+        return;
+    }
+
+    // The first stripe starts on a cache line and bins is a multiple of the line for
+    // bitDepth >= 4, so stripes never share a line.
+    const size_t alignWords = kCacheLine / sizeof(uint32_t);
+    std::vector<uint32_t> storage((size_t)stripes * bins + alignWords, 0);
+    uint32_t* partial = storage.data();
+    partial += (alignWords - (reinterpret_cast<uintptr_t>(partial) / sizeof(uint32_t)) % alignWords) % alignWords;
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range)
+    {
+        for (int s = range.start; s < range.end; s++)
+        {
+            countRows16(src, src.rows * s / stripes, src.rows * (s + 1) / stripes, bins - 1,
+                        partial + (size_t)s * bins);
+        }
+    }, stripes);
+
+    for (int s = 0; s < stripes; s++) {
+        const uint32_t* p = partial + (size_t)s * bins;
+        for (int i = 0; i < bins; i++) hist[i] += p[i];
+    }
+}
+
+size_t histogramCount(const Histogram256& hist)
+{
+    size_t n = 0;
+    for (int i = 0; i < 256; i++) n += hist[i];
+    return n;
+}
+
+template<typename Hist>
+static void meanStdDev(const Hist& hist, double& mean, double& stddev, double scale)
+{
+    // Integer moments first, so the only rounding happens in the final division.
+    uint64_t n = 0, s1 = 0;
+    double s2 = 0;
+    for (size_t i = 0; i < hist.size(); i++) {
+        n += hist[i];
+        s1 += (uint64_t)i * hist[i];
+        s2 += (double)((uint64_t)i * i) * hist[i];
+    }
+    if (n == 0) {
+        mean = stddev = 0;
+        return;
+    }
+    double m = (double)s1 / n;
+    double var = std::max(0.0, s2 / n - m * m);
+    mean = m * scale;
+    stddev = std::sqrt(var) * scale;
+}
+
+void histogramMeanStdDev(const Histogram256& hist, double& mean, double& stddev, double scale)
+{
+    meanStdDev(hist, mean, stddev, scale);
+}
+
+void histogramMeanStdDev(const std::vector<uint32_t>& hist, double& mean, double& stddev, double scale)
+{
+    meanStdDev(hist, mean, stddev, scale);
+}
+
+SamplingErrorBound histogramErrorBound(size_t samples, double delta)
+{
+    SamplingErrorBound bound;
+    if (samples == 0) {
+        bound.mean = bound.stddev = bound.cdf = 1.0;
+        return bound;
+    }
+    // Hoeffding for a mean of independent [0, 1] variables; the CDF bound is a union over
+    // the 255 thresholds that matter.
+    bound.mean = std::sqrt(std::log(2.0 / delta) / (2.0 * samples));
+    bound.cdf = std::sqrt(std::log(2.0 * 255.0 / delta) / (2.0 * samples));
+    // |var_n - var| <= |m2_n - m2| + |mu_n^2 - mu^2| <= 3 eps, and |sqrt a - sqrt b| <= sqrt|a - b|,
+    // with both moments within eps at once: delta / 2 for each.
+    const double eps = std::sqrt(std::log(4.0 / delta) / (2.0 * samples));
+    bound.stddev = std::sqrt(3.0 * eps);
+    return bound;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+typedef std::array<uint32_t, 256> Histogram256;
+
+// The histogram engine of the project; every 256-bin histogram goes through here.
+//
+// Counts the values of an 8-bit single-channel image. With `parallel`, large images are
+// split into one row stripe per thread on OpenCV's pool. Each stripe counts into its own
+// cache-line aligned set of four interleaved banks (so repeated values do not serialise on
+// one counter) and the banks are summed at the end. Small images are counted on the calling
+// thread.
+//
+// step > 1 samples instead of reading every pixel: the image is cut into step x step blocks
+// and one pixel is read from each, at a position picked by a fixed hash of the block index.
+// This is stratified sampling, so it is repeatable from run to run and not aliased by
+// periodic content. See histogramErrorBound() for the resulting accuracy.
+void histogram256(const cv::Mat& src, Histogram256& hist, bool parallel = true, int step = 1);
+
+// Histogram of max(c0, c1, c2) of a 3- or 4-channel 8-bit image, i.e. of the HSV value
+// plane, without building that plane. Channel order does not matter.
+void histogramMaxRGB(const cv::Mat& src, Histogram256& hist, bool parallel = true, int step = 1);
+
+// Histogram of a CV_16U image with 1 channel (its values) or 3/4 channels (max of the first
+// three) holding `bitDepth`-bit samples: 2^bitDepth bins, larger values go to the last bin.
+// Stripes count into private histograms as above; there is a single bank per stripe, since
+// four banks of 65536 bins would no longer fit any cache.
+void histogram16(const cv::Mat& src, std::vector<uint32_t>& hist, int bitDepth, bool parallel = true);
+
+// Number of pixels counted, i.e. the sum of all bins.
+size_t histogramCount(const Histogram256& hist);
+
+// Mean and population standard deviation (as cv::meanStdDev) of the image the histogram was
+// taken from, with every bin value multiplied by `scale`. Exact up to double rounding.
+void histogramMeanStdDev(const Histogram256& hist, double& mean, double& stddev, double scale = 1.0 / 255.0);
+void histogramMeanStdDev(const std::vector<uint32_t>& hist, double& mean, double& stddev, double scale);
+
+// Estimated deviation of statistics from a sampled histogram against the full image. Values
+// are on the normalised scale (V / 255 for mean and stddev, 0..1 for the CDF).
+struct SamplingErrorBound
+{
+    double mean;     // |mu_sampled - mu|
+    double stddev;   // |sigma_sampled - sigma|
+    double cdf;      // max over bins of |CDF_sampled - CDF|
+};
+
+// Heuristic error estimate for a histogram of `samples` stratified samples: the Hoeffding
+// bounds that would hold with probability >= 1 - delta if every block contributed an
+// independent, uniformly drawn pixel. They are not guarantees: the position in each block
+// comes from a fixed hash, so an image whose content lines up with it can do worse, and
+// partial blocks at the right and bottom border are slightly over-weighted. The CDF estimate
+// takes a union bound over the bins, the stddev one combines the mean and second-moment
+// events at delta / 2 each. For example a 48 MP frame at step 8 has 750000 samples and, with
+// delta = 1e-3, is estimated to deviate by 0.0023 in mu, 0.084 in sigma (a loose bound) and
+// 0.0030 in the CDF.
+SamplingErrorBound histogramErrorBound(size_t samples, double delta = 1e-3);
@@ -0,0 +1,10 @@
+#pragma once
+
+// Logging used by the platform-neutral algorithm code: logcat on Android, stderr elsewhere.
+#ifdef __ANDROID__
+#include <android/log.h>
+#define IMGPROC_LOGE(...) __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", __VA_ARGS__)
+#else
+#include <cstdio>
+#define IMGPROC_LOGE(...) (std::fprintf(stderr, __VA_ARGS__), std::fputc('\n', stderr))
+#endif
@@ -0,0 +1,295 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "Pipeline.h"
+#include "AGCIE.h"
+#include "AGCWD.h"
+#include "BIMEF_Trial.h"
+#include "ImageProcLog.h"
+#include "Trace.h"
+
+namespace {
+
+class ResizeStage : public PipelineStage
+{
+public:
+    explicit ResizeStage(double factor) : factor(factor) {}
+    const char* name() const { return factor > 0 ? "downscale" : "upscale"; }
+    void run(const cv::Mat& src, cv::Mat& dst, const PipelineContext& ctx)
+    {
+        if (factor > 0) cv::resize(src, dst, cv::Size(), factor, factor);
+        else cv::resize(src, dst, ctx.inputSize);
+    }
+
+private:
+    double factor;   // <= 0: back to the pipeline input size
+};
+
+class ChannelStage : public PipelineStage
+{
+public:
+    explicit ChannelStage(int channels) : channels(channels) {}
+    const char* name() const { return channels == 4 ? "bgra" : "bgr"; }
+    void run(const cv::Mat& src, cv::Mat& dst, const PipelineContext&)
+    {
+        if (src.channels() == channels) src.copyTo(dst);
+        else if (channels == 4) cv::cvtColor(src, dst, src.channels() == 1 ? cv::COLOR_GRAY2BGRA : cv::COLOR_BGR2BGRA);
+        else cv::cvtColor(src, dst, src.channels() == 1 ? cv::COLOR_GRAY2BGR : cv::COLOR_BGRA2BGR);
+    }
+
+private:
+    int channels;
+};
+
+class EnhanceStage : public PipelineStage
+{
+public:
+    EnhanceStage(int algorithm, double alpha, int histogramStep, int tiles = 8,
+                 BIMEFSolver solver = BIMEF_SOLVER_IC, BIMEFStorage storage = BIMEF_STORAGE_FLOAT,
+                 int tileSize = 0)
+        : algorithm(algorithm), alpha(alpha), histogramStep(histogramStep), tiles(tiles), solver(solver),
+          storage(storage), tileSize(tileSize) {}
+    const char* name() const
+    {
+        return algorithm == 0 ? "AGCIE" : algorithm == 1 ? "AGCWD" : algorithm == 2 ? "BIMEF" : "AGCWDLOCAL";
+    }
+    void run(const cv::Mat& src, cv::Mat& dst, const PipelineContext& ctx)
+    {
+        // Produce the channel layout of the final destination, so a later resize can write
+        // straight into it.
+        dst.create(src.size(), ctx.outputType);
+        EnhanceBuffers& buffers = ctx.session->buffers;
+        if (algorithm == 0) AGCIE(src, dst, buffers, histogramStep);
+        else if (algorithm == 1) AGCWD(src, dst, buffers, alpha, histogramStep);
+        else if (algorithm == 2) BIMEF(src, dst, buffers, 0.5f, -0.3293f, 1.1258f, solver, storage, tileSize);
+        else AGCWDLocal(src, dst, tiles, alpha);
+    }
+
+private:
+    int algorithm;
+    double alpha;
+    int histogramStep;
+    int tiles;
+    BIMEFSolver solver;
+    BIMEFStorage storage;
+    int tileSize;
+};
+
+class PointStage : public PipelineStage
+{
+public:
+    PointStage(const char* stageName, const std::array<uchar, 256>& table) : stageName(stageName), table(table) {}
+    const char* name() const { return stageName; }
+    void run(const cv::Mat& src, cv::Mat& dst, const PipelineContext&)
+    {
+        cv::LUT(src, table, dst);
+    }
+    bool pointTable(std::array<uchar, 256>& out) const
+    {
+        out = table;
+        return true;
+    }
+
+private:
+    const char* stageName;
+    std::array<uchar, 256> table;
+};
+
+std::vector<double> parseNumbers(const std::string& arg)
+{
+    std::vector<double> values;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) values.push_back(std::atof(item.c_str()));
+    }
+    return values;
+}
+
+std::mutex registryMutex;
+
+std::map<std::string, PipelineStageFactory>& registry()
+{
+    static std::map<std::string, PipelineStageFactory> stages;
+    if (stages.empty()) {
+        stages["downscale"] = [](const std::string& arg) -> std::unique_ptr<PipelineStage> {
+            double factor = arg.empty() ? 0.5 : std::atof(arg.c_str());
+            CV_Assert( factor > 0 );
+            return std::unique_ptr<PipelineStage>(new ResizeStage(factor));
+        };
+        stages["upscale"] = [](const std::string&) -> std::unique_ptr<PipelineStage> {
+            return std::unique_ptr<PipelineStage>(new ResizeStage(0));
+        };
+        stages["bgr"] = [](const std::string&) -> std::unique_ptr<PipelineStage> {
+            return std::unique_ptr<PipelineStage>(new ChannelStage(3));
+        };
+        stages["bgra"] = [](const std::string&) -> std::unique_ptr<PipelineStage> {
+            return std::unique_ptr<PipelineStage>(new ChannelStage(4));
+        };
+        stages["AGCIE"] = [](const std::string& arg) -> std::unique_ptr<PipelineStage> {
+            int step = arg.empty() ? 1 : std::atoi(arg.c_str());
+            CV_Assert( step >= 1 );
+            return std::unique_ptr<PipelineStage>(new EnhanceStage(0, 0, step));
+        };
+        stages["AGCWD"] = [](const std::string& arg) -> std::unique_ptr<PipelineStage> {
+            std::vector<double> v = parseNumbers(arg);
+            double alpha = v.size() > 0 ? v[0] : 0.5;
+            int step = v.size() > 1 ? (int)v[1] : 1;
+            CV_Assert( step >= 1 );
+            return std::unique_ptr<PipelineStage>(new EnhanceStage(1, alpha, step));
+        };
+        stages["BIMEF"] = [](const std::string& arg) -> std::unique_ptr<PipelineStage> {
+            // Comma-separated options: a solver (ic, jacobi, multigrid), a storage (float, half)
+            // and a smoothing tile size (tileN).
+            BIMEFSolver solver = BIMEF_SOLVER_IC;
+            BIMEFStorage storage = BIMEF_STORAGE_FLOAT;
+            int tileSize = 0;
+            std::stringstream ss(arg);
+            std::string option;
+            while (std::getline(ss, option, ',')) {
+                if (option == "ic") solver = BIMEF_SOLVER_IC;
+                else if (option == "jacobi") solver = BIMEF_SOLVER_MATRIX_FREE;
+                else if (option == "multigrid") solver = BIMEF_SOLVER_MULTIGRID;
+                else if (option == "half") storage = BIMEF_STORAGE_HALF;
+                else if (option == "float") storage = BIMEF_STORAGE_FLOAT;
+                else if (option.compare(0, 4, "tile") == 0 && option.size() > 4) {
+                    tileSize = std::atoi(option.c_str() + 4);
+                    CV_Assert( tileSize >= 16 );
+                }
+                else if (!option.empty()) CV_Error(cv::Error::StsBadArg, "Unknown BIMEF option: " + option);
+            }
+            return std::unique_ptr<PipelineStage>(new EnhanceStage(2, 0, 1, 8, solver, storage, tileSize));
+        };
+        stages["AGCWDLOCAL"] = [](const std::string& arg) -> std::unique_ptr<PipelineStage> {
+            std::vector<double> v = parseNumbers(arg);
+            int tiles = v.size() > 0 ? (int)v[0] : 8;
+            double alpha = v.size() > 1 ? v[1] : 0.5;
+            CV_Assert( tiles >= 1 );
+            return std::unique_ptr<PipelineStage>(new EnhanceStage(3, alpha, 1, tiles));
+        };
+        // Same tables as cv::intensity_transform::gammaCorrection / contrastStretching.
+        stages["gamma"] = [](const std::string& arg) -> std::unique_ptr<PipelineStage> {
+            double gamma = std::atof(arg.c_str());
+            CV_Assert( gamma > 0 );
+            std::array<uchar, 256> table;
+            for (int i = 0; i < 256; i++) {
+                table[i] = cv::saturate_cast<uchar>(std::pow(i / 255.0, gamma) * 255.0);
+            }
+            return std::unique_ptr<PipelineStage>(new PointStage("gamma", table));
+        };
+        stages["stretch"] = [](const std::string& arg) -> std::unique_ptr<PipelineStage> {
+            std::vector<double> v = parseNumbers(arg);
+            CV_Assert( v.size() == 4 && v[0] > 0 && v[0] < v[2] && v[2] < 255 );
+            const int r1 = (int)v[0], s1 = (int)v[1], r2 = (int)v[2], s2 = (int)v[3];
+            std::array<uchar, 256> table;
+            for (int i = 0; i < 256; i++) {
+                if (i <= r1) table[i] = cv::saturate_cast<uchar>(((float)s1 / (float)r1) * i);
+                else if (i <= r2) table[i] = cv::saturate_cast<uchar>(((float)(s2 - s1) / (float)(r2 - r1)) * (i - r1) + s1);
+                else table[i] = cv::saturate_cast<uchar>(((float)(255 - s2) / (float)(255 - r2)) * (i - r2) + s2);
+            }
+            return std::unique_ptr<PipelineStage>(new PointStage("stretch", table));
+        };
+    }
+    return stages;
+}
+
+} // namespace
+
+void registerPipelineStage(const std::string& name, PipelineStageFactory factory)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry()[name] = factory;
+}
+
+Pipeline::Pipeline(const std::string& description) : desc(description)
+{
+    std::vector<std::unique_ptr<PipelineStage> > stages;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        std::stringstream ss(description);
+        std::string item;
+        while (std::getline(ss, item, '|')) {
+            if (item.empty()) continue;
+            size_t colon = item.find(':');
+            std::string stageName = item.substr(0, colon);
+            std::string arg = colon == std::string::npos ? std::string() : item.substr(colon + 1);
+            std::map<std::string, PipelineStageFactory>::iterator it = registry().find(stageName);
+            if (it == registry().end()) {
+                CV_Error(cv::Error::StsBadArg, "Unknown pipeline stage: " + stageName);
+            }
+            stages.push_back(it->second(arg));
+        }
+    }
+    CV_Assert( !stages.empty() );
+
+    // Fuse every run of point-wise stages into one table: out = t_n(...t_2(t_1(in))). A lone
+    // point stage becomes a table step too, so alpha is handled the same way either way.
+    for (size_t i = 0; i < stages.size(); i++) {
+        Step step;
+        std::array<uchar, 256> table;
+        if (stages[i]->pointTable(table)) {
+            step.name = stages[i]->name();
+            step.table = table;
+            std::array<uchar, 256> next;
+            while (i + 1 < stages.size() && stages[i + 1]->pointTable(next)) {
+                for (int v = 0; v < 256; v++) step.table[v] = next[step.table[v]];
+                step.name += std::string("+") + stages[i + 1]->name();
+                i++;
+            }
+        } else {
+            step.name = stages[i]->name();
+            step.stage = std::move(stages[i]);
+        }
+        steps.push_back(std::move(step));
+    }
+    times.assign(steps.size(), 0.0);
+}
+
+void Pipeline::runStep(Step& step, const cv::Mat& src, cv::Mat& dst, const PipelineContext& ctx)
+{
+    if (step.stage) {
+        step.stage->run(src, dst, ctx);
+        return;
+    }
+    // Point step: one LUT pass, leaving an alpha channel untouched.
+    const int cn = src.channels();
+    lut.create(1, 256, CV_8UC(cn));
+    for (int v = 0; v < 256; v++) {
+        uchar* entry = lut.ptr<uchar>(0) + v * cn;
+        for (int c = 0; c < cn; c++) entry[c] = (cn == 4 && c == 3) ? (uchar)v : step.table[v];
+    }
+    cv::LUT(src, lut, dst);
+}
+
+void Pipeline::run(const cv::Mat& src, cv::Mat& dst, EnhanceSession& session)
+{
+    PipelineContext ctx;
+    ctx.session = &session;
+    ctx.inputSize = src.size();
+    ctx.outputType = dst.type() == CV_8UC4 ? CV_8UC4 : CV_8UC3;
+
+    const cv::Mat* in = &src;
+    for (size_t i = 0; i < steps.size(); i++) {
+        IMGPROC_TRACE_SCOPE_COPY(steps[i].name);
+        cv::Mat& out = i + 1 == steps.size() ? dst : buffers[i & 1];
+        auto start = std::chrono::high_resolution_clock::now();
+        runStep(steps[i], *in, out, ctx);
+        auto end = std::chrono::high_resolution_clock::now();
+        times[i] = std::chrono::duration<double, std::milli>(end - start).count();
+        in = &out;
+    }
+}
+
+Pipeline& sessionPipeline(EnhanceSession& session, const std::string& description)
+{
+    if (!session.pipeline || session.pipeline->description() != description) {
+        session.pipeline = std::make_shared<Pipeline>(description);
+    }
+    return *session.pipeline;
+}
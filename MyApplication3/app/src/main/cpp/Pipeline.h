@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "EnhanceSession.h"
+
+// Per-run information handed to every stage.
+struct PipelineContext
+{
+    EnhanceSession* session;
+    cv::Size inputSize;   // size of the image the pipeline was started on
+    int outputType;       // CV_8UC4 when the final destination is RGBA, CV_8UC3 otherwise
+};
+
+// One step of an enhancement pipeline, e.g. a resize, a color conversion or an algorithm.
+class PipelineStage
+{
+public:
+    virtual ~PipelineStage() {}
+    virtual const char* name() const = 0;
+    virtual void run(const cv::Mat& src, cv::Mat& dst, const PipelineContext& ctx) = 0;
+    // Point-wise stages return true and fill `table` with their per-channel mapping, which
+    // lets the pipeline fuse runs of them into a single LUT pass.
+    virtual bool pointTable(std::array<uchar, 256>& table) const { return false; }
+};
+
+// Creates a stage from the argument written after ':' in a pipeline description (may be empty).
+typedef std::function<std::unique_ptr<PipelineStage>(const std::string& arg)> PipelineStageFactory;
+
+// Makes a stage available to pipeline descriptions under `name`. The built-in stages are
+//   downscale[:f]   resize by f (default 0.5)
+//   upscale         resize back to the pipeline input size
+//   bgr, bgra       drop / add the alpha channel
+//   AGCIE[:step], AGCWD[:alpha[,step]]   step: histogram sampling, see Histogram.h
+//   BIMEF[:options]   comma-separated: solver ic|jacobi|multigrid (BIMEFSolver, default ic), storage
+//                     float|half (BIMEFStorage), tileN to smooth in tiles of N pixels
+//   AGCWDLOCAL[:tiles[,alpha]]
+//   gamma:g, stretch:r1,s1,r2,s2   point operations (fusable)
+void registerPipelineStage(const std::string& name, PipelineStageFactory factory);
+
+// A chain of stages described as "stage[:arg]|stage[:arg]|...", e.g. "downscale|AGCIE|upscale".
+// Adjacent point-wise stages are fused into one LUT, intermediate images live in two
+// ping-pong buffers that are reused across runs, and every step is timed.
+class Pipeline
+{
+public:
+    explicit Pipeline(const std::string& description);
+
+    void run(const cv::Mat& src, cv::Mat& dst, EnhanceSession& session);
+
+    const std::string& description() const { return desc; }
+    size_t stepCount() const { return steps.size(); }
+    // Name of a step after fusion, e.g. "gamma+stretch".
+    const std::string& stepName(size_t i) const { return steps[i].name; }
+    // Milliseconds spent in each step during the last run().
+    const std::vector<double>& stepTimes() const { return times; }
+
+private:
+    struct Step
+    {
+        std::string name;
+        std::unique_ptr<PipelineStage> stage;   // null for a point step, which runs `table`
+        std::array<uchar, 256> table;
+    };
+
+    void runStep(Step& step, const cv::Mat& src, cv::Mat& dst, const PipelineContext& ctx);
+
+    std::string desc;
+    std::vector<Step> steps;
+    std::vector<double> times;
+    cv::Mat buffers[2];
+    cv::Mat lut;
+};
+
+// Pipeline cached in the session for `description`, rebuilt only when the description changes.
+Pipeline& sessionPipeline(EnhanceSession& session, const std::string& description);
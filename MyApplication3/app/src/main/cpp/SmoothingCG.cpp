@@ -0,0 +1,109 @@
+#include <vector>
+
+#include "SmoothingCG.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+// Runs fn(begin, end) -> double over the blocks of [0, n) and adds the results in block order.
+template<typename Fn>
+static double reduce(int n, int grain, const Fn& fn)
+{
+    const int blocks = parallelBlocks(n, grain);
+    double local[64];
+    std::vector<double> more;
+    double* partial = local;
+    if (blocks > 64) {
+        more.resize(blocks);
+        partial = more.data();
+    }
+    parallelFor(n, grain, [&](int block, int begin, int end)
+    {
+        partial[block] = fn(begin, end);
+    });
+    double sum = 0;
+    for (int b = 0; b < blocks; b++) sum += partial[b];
+    return sum;
+}
+
+double smoothingDot(const float* a, const float* b, int n)
+{
+    return reduce(n, SmoothingOperator::kParallelPixels, [&](int begin, int end)
+    {
+        double s = 0;
+        for (int i = begin; i < end; i++) s += a[i] * b[i];
+        return s;
+    });
+}
+
+double smoothingProductDot(const SmoothingOperator& A, const float* p, float* q)
+{
+    IMGPROC_TRACE_SCOPE("SmoothingOperator");
+    const int r = A.imageRows();
+    return reduce(A.imageCols(), A.parallelColumnGrain(), [&](int begin, int end)
+    {
+        const size_t first = (size_t)begin * r, last = (size_t)end * r;
+        std::fill(q + first, q + last, 0.0f);
+        A.multiplyAdd(p, q, 1.0f, begin, end);
+        double s = 0;
+        for (size_t i = first; i < last; i++) s += p[i] * q[i];
+        return s;
+    });
+}
+
+double smoothingResidual(const SmoothingOperator& A, const float* b, const float* x, float* r)
+{
+    const int rows = A.imageRows();
+    return reduce(A.imageCols(), A.parallelColumnGrain(), [&](int begin, int end)
+    {
+        const size_t first = (size_t)begin * rows, last = (size_t)end * rows;
+        std::copy(b + first, b + last, r + first);
+        A.multiplyAdd(x, r, -1.0f, begin, end);
+        double s = 0;
+        for (size_t i = first; i < last; i++) s += r[i] * r[i];
+        return s;
+    });
+}
+
+double smoothingUpdate(float* x, float* r, const float* p, const float* q, float alpha, int n)
+{
+    return reduce(n, SmoothingOperator::kParallelPixels, [&](int begin, int end)
+    {
+        double s = 0;
+        for (int i = begin; i < end; i++)
+        {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+            s += r[i] * r[i];
+        }
+        return s;
+    });
+}
+
+void smoothingDirection(float* p, const float* z, float beta, int n)
+{
+    parallelFor(n, SmoothingOperator::kParallelPixels, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; i++) p[i] = z[i] + beta * p[i];
+    });
+}
+
+double smoothingPrecondition(const SmoothingJacobi& M, const float* r, float* z, int n)
+{
+    const float* inv = M.inverseDiagonal().data();
+    return reduce(n, SmoothingOperator::kParallelPixels, [&](int begin, int end)
+    {
+        double s = 0;
+        for (int i = begin; i < end; i++)
+        {
+            z[i] = inv[i] * r[i];
+            s += r[i] * z[i];
+        }
+        return s;
+    });
+}
+
+double smoothingPrecondition(const SmoothingMultigridPreconditioner& M, const float* r, float* z, int n)
+{
+    M.solve(r, z);
+    return smoothingDot(r, z, n);
+}
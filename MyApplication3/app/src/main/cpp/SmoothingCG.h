@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "FrameArena.h"
+#include "SmoothingMultigrid.h"
+#include "SmoothingOperator.h"
+
+// Vector steps of SmoothingCG on arrays of A.rows() floats, split over workerPool(). The
+// reductions are summed per block in double and then over the blocks in order, so the result
+// does not depend on which thread ran what.
+
+// q = A p, returns p . q
+double smoothingProductDot(const SmoothingOperator& A, const float* p, float* q);
+// x += alpha p, r -= alpha q, returns r . r
+double smoothingUpdate(float* x, float* r, const float* p, const float* q, float alpha, int n);
+// p = z + beta p
+void smoothingDirection(float* p, const float* z, float beta, int n);
+// r = b - A x, returns r . r
+double smoothingResidual(const SmoothingOperator& A, const float* b, const float* x, float* r);
+double smoothingDot(const float* a, const float* b, int n);
+
+// z = M^-1 r, returns r . z
+double smoothingPrecondition(const SmoothingJacobi& M, const float* r, float* z, int n);
+double smoothingPrecondition(const SmoothingMultigridPreconditioner& M, const float* r, float* z, int n);
+
+// Preconditioned conjugate gradient on SmoothingOperator. The iteration and stopping rule
+// are those of Eigen::ConjugateGradient (|b - A x| <= tolerance * |b|), but the product, dot
+// products and updates all run on the worker pool, fused into three passes over the vectors
+// per iteration besides the preconditioner; Eigen's run on one thread unless built with
+// OpenMP. Work vectors come from the arena given to setArena(), which must be called before
+// compute().
+template<typename Preconditioner>
+class SmoothingCG
+{
+public:
+    SmoothingCG()
+        : arena(nullptr), A(nullptr), tolerance(std::numeric_limits<float>::epsilon()), maxIterations(-1),
+          r(nullptr), p(nullptr), q(nullptr), z(nullptr), iters(0), err(0) {}
+
+    void setArena(FrameArena& a) { arena = &a; }
+    void setTolerance(float t) { tolerance = t; }
+    void setMaxIterations(int n) { maxIterations = n; }
+    Preconditioner& preconditioner() { return M; }
+
+    SmoothingCG& compute(const SmoothingOperator& mat)
+    {
+        CV_Assert( arena != nullptr );
+        A = &mat;
+        M.compute(mat);
+        const size_t k = (size_t)mat.rows();
+        r = arena->allocate<float>(k);
+        p = arena->allocate<float>(k);
+        q = arena->allocate<float>(k);
+        z = arena->allocate<float>(k);
+        return *this;
+    }
+
+    // Solves A x = b starting from `guess`, or from zero when it is null. x may be the guess.
+    void solve(const float* b, const float* guess, float* x)
+    {
+        const int n = (int)A->rows();
+        const int maxIters = maxIterations < 0 ? 2 * n : maxIterations;
+        iters = 0;
+        err = 0;
+
+        const double bNorm2 = smoothingDot(b, b, n);
+        if (bNorm2 == 0) {
+            std::fill(x, x + n, 0.0f);
+            return;
+        }
+        const double threshold = std::max((double)tolerance * tolerance * bNorm2,
+                                          (double)std::numeric_limits<float>::min());
+
+        double rNorm2;
+        if (guess) {
+            if (guess != x) std::copy(guess, guess + n, x);
+            rNorm2 = smoothingResidual(*A, b, x, r);
+        } else {
+            std::fill(x, x + n, 0.0f);
+            std::copy(b, b + n, r);
+            rNorm2 = bNorm2;
+        }
+        if (rNorm2 < threshold) {
+            err = (float)std::sqrt(rNorm2 / bNorm2);
+            return;
+        }
+
+        double rz = smoothingPrecondition(M, r, p, n);
+        int i = 0;
+        while (i < maxIters)
+        {
+            const float alpha = (float)(rz / smoothingProductDot(*A, p, q));
+            rNorm2 = smoothingUpdate(x, r, p, q, alpha, n);
+            if (rNorm2 < threshold) break;
+            const double rzOld = rz;
+            rz = smoothingPrecondition(M, r, z, n);
+            smoothingDirection(p, z, (float)(rz / rzOld), n);
+            i++;
+        }
+        err = (float)std::sqrt(rNorm2 / bNorm2);
+        iters = i;
+    }
+
+    int iterations() const { return iters; }
+    float error() const { return err; }
+
+private:
+    FrameArena* arena;
+    const SmoothingOperator* A;
+    Preconditioner M;
+    float tolerance;
+    int maxIterations;
+    float* r;   // residual
+    float* p;   // search direction
+    float* q;   // A p
+    float* z;   // preconditioned residual
+    int iters;
+    float err;
+};
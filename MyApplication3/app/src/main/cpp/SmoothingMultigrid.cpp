@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cmath>
+
+#include "SmoothingMultigrid.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+// Levels stop at this many pixels or when a side would drop below kMinSide.
+static const size_t kCoarsestPixels = 256;
+static const int kMinSide = 4;
+// Red-black sweeps before and after the coarse correction, and on the coarsest level.
+// The coarse operators are increasingly dominated by their identity part, so a few sweeps
+// solve the coarsest level well enough.
+static const int kSmoothingSweeps = 2;
+static const int kCoarsestSweeps = 8;
+
+// Gauss-Seidel update of the pixels with (i + j) % 2 == color in columns [begin, end), in
+// increasing (j, i) order, or in exactly the opposite order when `reverse` is set.
+static void relaxColumns(const SmoothingOperator& A, const float* b, float* x, int color, int begin, int end,
+                         bool reverse)
+{
+    const int r = A.imageRows();
+    const int c = A.imageCols();
+    const float* d = A.diagonalData();
+    const float* wh = A.horizontalWeights();
+    const float* wv = A.verticalWeights();
+    for (int k = begin; k < end; k++)
+    {
+        const int j = reverse ? begin + end - 1 - k : k;
+        const size_t left = (size_t)(j == 0 ? c - 1 : j - 1) * r;
+        const size_t right = (size_t)(j == c - 1 ? 0 : j + 1) * r;
+        const size_t col = (size_t)j * r;
+        const float* xl = x + left;
+        const float* xr = x + right;
+        const float* hl = wh + left;
+        const float* h0 = wh + col;
+        const float* v0 = wv + col;
+        const float* d0 = d + col;
+        const float* b0 = b + col;
+        float* x0 = x + col;
+        auto update = [&](int i)
+        {
+            const int up = i == 0 ? r - 1 : i - 1;
+            const int down = i == r - 1 ? 0 : i + 1;
+            x0[i] = (b0[i] + h0[i] * xr[i] + hl[i] * xl[i] + v0[i] * x0[down] + v0[up] * x0[up]) / d0[i];
+        };
+        const int first = (j + color) & 1;
+        if (!reverse) {
+            for (int i = first; i < r; i += 2) update(i);
+        } else if (first < r) {
+            for (int i = first + (r - 1 - first) / 2 * 2; i >= first; i -= 2) update(i);
+        }
+    }
+}
+
+// One colour of a red-black sweep. On an odd-sized (periodic) side two same-coloured pixels
+// meet across the wrap; they are simply updated in sequence. Apart from that, pixels of one
+// colour only read the other, so the columns are relaxed in parallel. With an odd number of
+// columns the last one reads column 0 of its own colour and goes after the others, which
+// gives the same result as a sequential sweep. A `reverse` sweep undoes that order exactly
+// (last column first, rows descending), which makes it the adjoint of the forward one.
+static void relax(const SmoothingOperator& A, const float* b, float* x, int color, bool reverse)
+{
+    const int c = A.imageCols();
+    const int last = c > 1 && (c & 1) ? c - 1 : c;
+    if (reverse && last < c) relaxColumns(A, b, x, color, last, c, true);
+    parallelFor(last, A.parallelColumnGrain(), [&](int, int begin, int end)
+    {
+        relaxColumns(A, b, x, color, begin, end, reverse);
+    });
+    if (!reverse && last < c) relaxColumns(A, b, x, color, last, c, false);
+}
+
+// r = b - A x
+static void residual(const SmoothingOperator& A, const float* b, const float* x, float* r)
+{
+    const size_t k = (size_t)A.rows();
+    std::copy(b, b + k, r);
+    A.multiplyAdd(x, r, -1.0f);
+}
+
+static float norm(const float* v, size_t k)
+{
+    double s = 0;
+    for (size_t i = 0; i < k; i++) s += (double)v[i] * v[i];
+    return (float)std::sqrt(s);
+}
+
+void SmoothingMultigrid::build(const SmoothingOperator& A, FrameArena& arena)
+{
+    IMGPROC_TRACE_SCOPE("SmoothingMultigrid.build");
+    levels.clear();
+    Level fine;
+    fine.A = A;
+    fine.b = fine.x = nullptr;
+    fine.r = arena.allocate<float>((size_t)A.rows());
+    levels.push_back(fine);
+
+    while ((size_t)levels.back().A.rows() > kCoarsestPixels &&
+           (levels.back().A.imageRows() + 1) / 2 >= kMinSide && (levels.back().A.imageCols() + 1) / 2 >= kMinSide)
+    {
+        Level coarse;
+        coarse.A = levels.back().A.coarsen(arena);
+        const size_t k = (size_t)coarse.A.rows();
+        coarse.b = arena.allocate<float>(k);
+        coarse.x = arena.allocate<float>(k);
+        coarse.r = arena.allocate<float>(k);
+        levels.push_back(coarse);
+    }
+}
+
+void SmoothingMultigrid::cycle(size_t l, const float* b, float* x) const
+{
+    const Level& level = levels[l];
+    const SmoothingOperator& A = level.A;
+    if (l + 1 == levels.size())
+    {
+        for (int s = 0; s < kCoarsestSweeps; s++) {
+            relax(A, b, x, 0, false);
+            relax(A, b, x, 1, false);
+        }
+        for (int s = 0; s < kCoarsestSweeps; s++) {
+            relax(A, b, x, 1, true);
+            relax(A, b, x, 0, true);
+        }
+        return;
+    }
+
+    for (int s = 0; s < kSmoothingSweeps; s++) {
+        relax(A, b, x, 0, false);
+        relax(A, b, x, 1, false);
+    }
+
+    // Restrict the residual (sum over each aggregate, P^T r), solve for the correction on the
+    // coarse level and add it back piecewise constant (P e).
+    residual(A, b, x, level.r);
+    const Level& coarse = levels[l + 1];
+    const int r = A.imageRows(), c = A.imageCols();
+    const int rc = coarse.A.imageRows();
+    const size_t kc = (size_t)coarse.A.rows();
+    std::fill(coarse.b, coarse.b + kc, 0.0f);
+    std::fill(coarse.x, coarse.x + kc, 0.0f);
+    for (int j = 0; j < c; j++)
+    {
+        const float* r0 = level.r + (size_t)j * r;
+        float* bc = coarse.b + (size_t)(j / 2) * rc;
+        for (int i = 0; i < r; i++) bc[i / 2] += r0[i];
+    }
+
+    cycle(l + 1, coarse.b, coarse.x);
+
+    for (int j = 0; j < c; j++)
+    {
+        float* x0 = x + (size_t)j * r;
+        const float* xc = coarse.x + (size_t)(j / 2) * rc;
+        for (int i = 0; i < r; i++) x0[i] += xc[i / 2];
+    }
+
+    // The pre-smoothing updates in exactly the reverse order (colours, columns and rows), so
+    // the post-smoother is the adjoint of the pre-smoother and the cycle stays symmetric.
+    for (int s = 0; s < kSmoothingSweeps; s++) {
+        relax(A, b, x, 1, true);
+        relax(A, b, x, 0, true);
+    }
+}
+
+void SmoothingMultigrid::vcycle(const float* b, float* x) const
+{
+    IMGPROC_TRACE_SCOPE("SmoothingMultigrid.vcycle");
+    const size_t k = (size_t)levels[0].A.rows();
+    std::fill(x, x + k, 0.0f);
+    cycle(0, b, x);
+}
+
+int SmoothingMultigrid::solve(const float* b, float* x, float tolerance, int maxCycles, float* error) const
+{
+    IMGPROC_TRACE_SCOPE("SmoothingMultigrid.solve");
+    const Level& fine = levels[0];
+    const size_t k = (size_t)fine.A.rows();
+    const float bnorm = std::max(norm(b, k), 1e-30f);
+    float rel = 0;
+    int cycles = 0;
+    for (; cycles < maxCycles; cycles++)
+    {
+        residual(fine.A, b, x, fine.r);
+        rel = norm(fine.r, k) / bnorm;
+        if (rel <= tolerance) break;
+        cycle(0, b, x);
+    }
+    if (cycles == maxCycles)
+    {
+        residual(fine.A, b, x, fine.r);
+        rel = norm(fine.r, k) / bnorm;
+    }
+    if (error) *error = rel;
+    return cycles;
+}
+
+SmoothingMultigridPreconditioner& SmoothingMultigridPreconditioner::compute(const SmoothingOperator& A)
+{
+    CV_Assert( arena != nullptr );
+    mg.build(A, *arena);
+    return *this;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include "SmoothingOperator.h"
+
+// Multigrid for the illumination smoothing system (SmoothingOperator). Levels are built by
+// Galerkin coarsening over 2x2 aggregates, which follows the texture weights W_h / W_v
+// instead of averaging across illumination edges, down to a few hundred pixels. Smoothing is
+// red-black Gauss-Seidel. A V-cycle costs O(N) and the number of cycles needed does not
+// grow with the resolution, unlike plain or Jacobi-preconditioned CG.
+class SmoothingMultigrid
+{
+public:
+    SmoothingMultigrid() {}
+
+    // Builds the hierarchy below A. A's coefficients must stay valid while this is used; the
+    // coarse levels and work vectors are allocated from `arena`.
+    void build(const SmoothingOperator& A, FrameArena& arena);
+
+    // x = M^-1 b: one V-cycle from a zero initial guess. The post-smoothing runs the
+    // pre-smoothing updates backwards, so M is symmetric positive definite and this can
+    // precondition CG.
+    void vcycle(const float* b, float* x) const;
+
+    // Standalone solver: V-cycles starting from the given x until
+    // |b - A x| <= tolerance * |b| or maxCycles. Returns the number of cycles run.
+    int solve(const float* b, float* x, float tolerance, int maxCycles, float* error = nullptr) const;
+
+    size_t levelCount() const { return levels.size(); }
+
+private:
+    struct Level
+    {
+        SmoothingOperator A;
+        float* b;   // right-hand side (coarse levels only)
+        float* x;   // correction (coarse levels only)
+        float* r;   // residual
+    };
+
+    void cycle(size_t l, const float* b, float* x) const;
+
+    std::vector<Level> levels;
+};
+
+// SmoothingMultigrid as a preconditioner of SmoothingCG. Call setArena() on
+// cg.preconditioner() before cg.compute().
+class SmoothingMultigridPreconditioner
+{
+public:
+    SmoothingMultigridPreconditioner() : arena(nullptr) {}
+
+    void setArena(FrameArena& a) { arena = &a; }
+
+    SmoothingMultigridPreconditioner& compute(const SmoothingOperator& A);
+
+    // x = M^-1 b on arrays of A.rows() floats.
+    void solve(const float* b, float* x) const { mg.vcycle(b, x); }
+
+private:
+    FrameArena* arena;
+    SmoothingMultigrid mg;
+};
@@ -0,0 +1,196 @@
+#include <algorithm>
+
+#include "SmoothingOperator.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+void SmoothingOperator::setWeights(const cv::Mat_<float>& W_h, const cv::Mat_<float>& W_v, float lambda,
+                                   FrameArena& arena, bool periodic)
+{
+    CV_Assert( W_h.size() == W_v.size() && !W_h.empty() );
+    r = W_h.rows;
+    c = W_h.cols;
+    const size_t k = (size_t)r * c;
+    float* dd = arena.allocate<float>(k);
+    float* h = arena.allocate<float>(k);
+    float* v = arena.allocate<float>(k);
+
+    // Transpose into the solver's column-major pixel order.
+    for (int i = 0; i < r; i++)
+    {
+        const float* wh_row = W_h[i];
+        const float* wv_row = W_v[i];
+        for (int j = 0; j < c; j++)
+        {
+            h[(size_t)j * r + i] = lambda * wh_row[j];
+            v[(size_t)j * r + i] = lambda * wv_row[j];
+        }
+    }
+    if (!periodic)
+    {
+        std::fill(h + (size_t)(c - 1) * r, h + k, 0.0f);
+        for (int j = 0; j < c; j++) v[(size_t)j * r + r - 1] = 0;
+    }
+
+    for (int j = 0; j < c; j++)
+    {
+        const float* h0 = h + (size_t)j * r;
+        const float* hl = h + (size_t)(j == 0 ? c - 1 : j - 1) * r;
+        const float* v0 = v + (size_t)j * r;
+        float* d0 = dd + (size_t)j * r;
+        for (int i = 0; i < r; i++)
+        {
+            d0[i] = 1 + h0[i] + hl[i] + v0[i] + v0[i == 0 ? r - 1 : i - 1];
+        }
+    }
+
+    d = dd;
+    wh = h;
+    wv = v;
+}
+
+void SmoothingOperator::multiplyAdd(const float* x, float* y, float alpha) const
+{
+    IMGPROC_TRACE_SCOPE("SmoothingOperator");
+    // Every column of y only depends on three columns of x, so the columns are split
+    // between the worker threads.
+    parallelFor(c, parallelColumnGrain(), [&](int, int begin, int end)
+    {
+        multiplyAdd(x, y, alpha, begin, end);
+    });
+}
+
+void SmoothingOperator::multiplyAdd(const float* x, float* y, float alpha, int beginCol, int endCol) const
+{
+    for (int j = beginCol; j < endCol; j++)
+    {
+        const size_t left = (size_t)(j == 0 ? c - 1 : j - 1) * r;
+        const size_t right = (size_t)(j == c - 1 ? 0 : j + 1) * r;
+        const size_t col = (size_t)j * r;
+        const float* x0 = x + col;
+        const float* xl = x + left;
+        const float* xr = x + right;
+        const float* d0 = d + col;
+        const float* h0 = wh + col;
+        const float* hl = wh + left;
+        const float* v0 = wv + col;
+        float* y0 = y + col;
+
+        auto row = [&](int i, int up, int down) -> float
+        {
+            return d0[i] * x0[i] - h0[i] * xr[i] - hl[i] * xl[i] - v0[i] * x0[down] - v0[up] * x0[up];
+        };
+
+        // The first and last rows wrap around; the rest is a branch-free, vectorisable sweep.
+        y0[0] += alpha * row(0, r - 1, r > 1 ? 1 : 0);
+        for (int i = 1; i < r - 1; i++)
+        {
+            y0[i] += alpha * (d0[i] * x0[i] - h0[i] * xr[i] - hl[i] * xl[i] - v0[i] * x0[i + 1] - v0[i - 1] * x0[i - 1]);
+        }
+        if (r > 1)
+        {
+            y0[r - 1] += alpha * row(r - 1, r - 2, 0);
+        }
+    }
+}
+
+SmoothingOperator SmoothingOperator::coarsen(FrameArena& arena) const
+{
+    const int rc = (r + 1) / 2;
+    const int cc = (c + 1) / 2;
+    const size_t kc = (size_t)rc * cc;
+    float* mass = arena.allocate<float>(kc);
+    float* h = arena.allocate<float>(kc);
+    float* v = arena.allocate<float>(kc);
+    std::fill(mass, mass + kc, 0.0f);
+    std::fill(h, h + kc, 0.0f);
+    std::fill(v, v + kc, 0.0f);
+
+    for (int j = 0; j < c; j++)
+    {
+        const size_t left = (size_t)(j == 0 ? c - 1 : j - 1) * r;
+        const size_t col = (size_t)j * r;
+        const int J = j / 2;
+        // Only the last fine column / row of an aggregate has edges leaving it.
+        const bool lastCol = j == c - 1 || (j & 1);
+        for (int i = 0; i < r; i++)
+        {
+            const size_t p = col + i;
+            const size_t q = (size_t)J * rc + i / 2;
+            // The identity part of the operator: what is left of the diagonal without the couplings.
+            mass[q] += d[p] - wh[p] - wh[left + i] - wv[p] - wv[col + (i == 0 ? r - 1 : i - 1)];
+            if (lastCol) h[q] += wh[p];
+            if (i == r - 1 || (i & 1)) v[q] += wv[p];
+        }
+    }
+
+    float* dd = mass;
+    for (int J = 0; J < cc; J++)
+    {
+        const float* h0 = h + (size_t)J * rc;
+        const float* hl = h + (size_t)(J == 0 ? cc - 1 : J - 1) * rc;
+        const float* v0 = v + (size_t)J * rc;
+        float* d0 = dd + (size_t)J * rc;
+        for (int I = 0; I < rc; I++)
+        {
+            d0[I] += h0[I] + hl[I] + v0[I] + v0[I == 0 ? rc - 1 : I - 1];
+        }
+    }
+    return SmoothingOperator(rc, cc, dd, h, v);
+}
+
+void SmoothingOperator::assemble(Eigen::SparseMatrix<float>& A, bool lowerOnly, bool valuesOnly) const
+{
+    const int k = r * c;
+    if (valuesOnly) {
+        CV_Assert( A.rows() == k && A.cols() == k && A.isCompressed() );
+    } else {
+        A.resize(k, k);
+        A.resizeNonZeros((Eigen::Index)(lowerOnly ? 3 : 5) * k);
+    }
+    int* outer = A.outerIndexPtr();
+    int* inner = A.innerIndexPtr();
+    float* values = A.valuePtr();
+
+    int n = 0;
+    for (int j = 0; j < c; j++)
+    {
+        const int left = (j == 0 ? c - 1 : j - 1) * r;
+        const int right = (j == c - 1 ? 0 : j + 1) * r;
+        const int col = j * r;
+        for (int i = 0; i < r; i++)
+        {
+            const int p = col + i;
+            const int up = col + (i == 0 ? r - 1 : i - 1);
+            // Column p: rows p, up, down, left and right. On sides of one or two pixels some
+            // of them coincide and are summed.
+            int rows[5] = { left + i, up, p, col + (i == r - 1 ? 0 : i + 1), right + i };
+            float vals[5] = { -wh[left + i], -wv[up], d[p], -wv[p], -wh[p] };
+            for (int a = 1; a < 5; a++)
+            {
+                for (int b = a; b > 0 && rows[b - 1] > rows[b]; b--)
+                {
+                    std::swap(rows[b - 1], rows[b]);
+                    std::swap(vals[b - 1], vals[b]);
+                }
+            }
+
+            if (!valuesOnly) outer[p] = n;
+            for (int a = 0; a < 5; a++)
+            {
+                if (lowerOnly && rows[a] < p) continue;
+                if (a > 0 && rows[a] == rows[a - 1])
+                {
+                    values[n - 1] += vals[a];
+                    continue;
+                }
+                if (!valuesOnly) inner[n] = rows[a];
+                values[n++] = vals[a];
+            }
+        }
+    }
+    if (!valuesOnly) {
+        outer[k] = n;
+        A.resizeNonZeros(n);
+    }
+}
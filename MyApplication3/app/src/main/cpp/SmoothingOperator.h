@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include "eigen/Eigen/Sparse"
+#include "FrameArena.h"
+
+class SmoothingOperator;
+
+namespace Eigen {
+namespace internal {
+template<>
+struct traits<SmoothingOperator> : public Eigen::internal::traits<Eigen::SparseMatrix<float> >
+{};
+} // namespace internal
+} // namespace Eigen
+
+// Matrix-free form of the illumination smoothing system of BIMEF (tsmooth):
+//
+//   (I + lambda * L(W_h, W_v)) t = t_b
+//
+// with L the weighted 5-point Laplacian, periodic or (without the wrap-around couplings)
+// with a Neumann boundary. Pixels are numbered column by column
+// (p = j * rows + i) like in the assembled sparse matrix, and the coefficients are stored in
+// that order too, so one product is a single sweep over three neighbouring columns instead of
+// an index-chasing SpMV. Nothing but the diagonal and the two weight planes is kept.
+//
+// BIMEF solves it with SmoothingCG (SmoothingCG.h), which runs on the worker pool. It is also
+// usable as the matrix of Eigen::ConjugateGradient, e.g. with SmoothingJacobi below.
+class SmoothingOperator : public Eigen::EigenBase<SmoothingOperator>
+{
+public:
+    typedef float Scalar;
+    typedef float RealScalar;
+    typedef int StorageIndex;
+    enum
+    {
+        ColsAtCompileTime = Eigen::Dynamic,
+        MaxColsAtCompileTime = Eigen::Dynamic,
+        IsRowMajor = false
+    };
+
+    SmoothingOperator() : r(0), c(0), d(nullptr), wh(nullptr), wv(nullptr) {}
+    // Operator over existing coefficient planes laid out as described above.
+    SmoothingOperator(int rows, int cols, const float* d, const float* wh, const float* wv)
+        : r(rows), c(cols), d(d), wh(wh), wv(wv) {}
+
+    // W_h, W_v: texture weights of an image of their size (row-major, as computeTextureWeights
+    // produces them). The coefficients are allocated from `arena` and stay valid until its
+    // next reset(). With periodic false, the last column of W_h and the last row of W_v, which
+    // couple the image to its opposite side, are dropped: the Neumann boundary of a piece cut
+    // out of a larger image. Every other method works on either form unchanged.
+    void setWeights(const cv::Mat_<float>& W_h, const cv::Mat_<float>& W_v, float lambda, FrameArena& arena,
+                    bool periodic = true);
+
+    Eigen::Index rows() const { return (Eigen::Index)r * c; }
+    Eigen::Index cols() const { return (Eigen::Index)r * c; }
+    int imageRows() const { return r; }
+    int imageCols() const { return c; }
+
+    // y += alpha * A * x, split by columns over workerPool() on large images.
+    void multiplyAdd(const float* x, float* y, float alpha) const;
+    // The same for the pixels of image columns [beginCol, endCol) only, on the calling thread.
+    void multiplyAdd(const float* x, float* y, float alpha, int beginCol, int endCol) const;
+
+    // Columns per parallelFor() block for sweeps over this operator's pixels, so that small
+    // (coarse multigrid) levels are not split at all.
+    int parallelColumnGrain() const { return std::max(1, kParallelPixels / std::max(r, 1)); }
+
+    // Writes the operator into A in compressed column form, straight into its index and value
+    // arrays (no triplets, sorting or transposes). With lowerOnly only the lower triangle is
+    // stored, for solvers that read a selfadjointView<Lower>(). With valuesOnly, A must already
+    // hold the pattern of an operator of this size and mode, and only the values are rewritten.
+    void assemble(Eigen::SparseMatrix<float>& A, bool lowerOnly, bool valuesOnly = false) const;
+
+    // Galerkin coarsening over 2x2 pixel aggregates (piecewise constant interpolation P, coarse
+    // operator P^T A P). The result has the same stencil: the weights of the fine edges between
+    // two aggregates are summed, so edges of the illumination keep separating the coarse
+    // pixels they fall between. Coefficients come from `arena`.
+    SmoothingOperator coarsen(FrameArena& arena) const;
+
+    const float* diagonalData() const { return d; }
+    const float* horizontalWeights() const { return wh; }
+    const float* verticalWeights() const { return wv; }
+
+    Eigen::Map<const Eigen::VectorXf> diagonal() const { return Eigen::Map<const Eigen::VectorXf>(d, rows()); }
+
+    template<typename Rhs>
+    Eigen::Product<SmoothingOperator, Rhs, Eigen::AliasFreeProduct> operator*(const Eigen::MatrixBase<Rhs>& x) const
+    {
+        return Eigen::Product<SmoothingOperator, Rhs, Eigen::AliasFreeProduct>(*this, x.derived());
+    }
+
+    // Fewest pixels worth handing to another thread.
+    static const int kParallelPixels = 32768;
+
+private:
+    int r, c;
+    const float* d;    // 1 + lambda * (sum of the four weights around p)
+    const float* wh;   // lambda * W_h: coupling of (i, j) and (i, j + 1)
+    const float* wv;   // lambda * W_v: coupling of (i, j) and (i + 1, j)
+};
+
+// Jacobi preconditioner for SmoothingOperator, for SmoothingCG and in the form Eigen's
+// iterative solvers expect.
+class SmoothingJacobi
+{
+public:
+    SmoothingJacobi() {}
+    template<typename MatType> explicit SmoothingJacobi(const MatType& mat) { compute(mat); }
+
+    SmoothingJacobi& analyzePattern(const SmoothingOperator&) { return *this; }
+    SmoothingJacobi& factorize(const SmoothingOperator& mat) { return compute(mat); }
+    SmoothingJacobi& compute(const SmoothingOperator& mat)
+    {
+        invDiag = mat.diagonal().cwiseInverse();
+        return *this;
+    }
+
+    // Returns an expression, so the solver's iteration does not allocate.
+    template<typename Rhs>
+    auto solve(const Eigen::MatrixBase<Rhs>& b) const
+    {
+        return invDiag.cwiseProduct(b.derived());
+    }
+
+    Eigen::ComputationInfo info() const { return Eigen::Success; }
+
+    const Eigen::VectorXf& inverseDiagonal() const { return invDiag; }
+
+private:
+    Eigen::VectorXf invDiag;
+};
+
+namespace Eigen {
+namespace internal {
+
+template<typename Rhs>
+struct generic_product_impl<SmoothingOperator, Rhs, SparseShape, DenseShape, GemvProduct>
+    : generic_product_impl_base<SmoothingOperator, Rhs, generic_product_impl<SmoothingOperator, Rhs> >
+{
+    typedef typename Product<SmoothingOperator, Rhs>::Scalar Scalar;
+
+    template<typename Dest>
+    static void scaleAndAddTo(Dest& dst, const SmoothingOperator& lhs, const Rhs& rhs, const Scalar& alpha)
+    {
+        // The solvers only multiply plain vectors, so this never copies.
+        Eigen::Ref<const Eigen::VectorXf> x(rhs);
+        Eigen::Ref<Eigen::VectorXf> y(dst);
+        lhs.multiplyAdd(x.data(), y.data(), alpha);
+    }
+};
+
+} // namespace internal
+} // namespace Eigen
@@ -0,0 +1,68 @@
+#include <cmath>
+#include <opencv2/core.hpp>
+
+#include "StreamingAGCWD.h"
+#include "AGCWD.h"
+#include "Histogram.h"
+#include "ValueGain.h"
+#include "Trace.h"
+
+StreamingAGCWD::StreamingAGCWD(double alpha, double smoothing, double threshold)
+    : alpha(alpha), smoothing(smoothing), threshold(threshold), initialized(false), rebuilt(false)
+{
+    CV_Assert( smoothing > 0 && smoothing <= 1 );
+}
+
+void StreamingAGCWD::reset()
+{
+    initialized = false;
+    rebuilt = false;
+}
+
+void StreamingAGCWD::process(const cv::Mat& src, cv::Mat& dst)
+{
+    IMGPROC_TRACE_SCOPE("StreamingAGCWD");
+    const int channels = src.channels();
+    Histogram256 hist;
+    if (channels == 1) {
+        histogram256(src, hist);
+    }
+    else {
+        histogramMaxRGB(src, hist);
+    }
+
+    const double total_pixels_inv = 1.0 / (double)src.total();
+    if (!initialized) {
+        for (int i = 0; i < 256; i++) {
+            pdf[i] = hist[i] * total_pixels_inv;
+        }
+    }
+    else {
+        for (int i = 0; i < 256; i++) {
+            pdf[i] += smoothing * (hist[i] * total_pixels_inv - pdf[i]);
+        }
+    }
+
+    double distance = 0;
+    if (initialized) {
+        for (int i = 0; i < 256; i++) {
+            distance += std::abs(pdf[i] - tablePdf[i]);
+        }
+        distance *= 0.5;
+    }
+
+    rebuilt = !initialized || distance > threshold;
+    if (rebuilt) {
+        AGCWDTable(pdf, alpha, table);
+        tablePdf = pdf;
+    }
+    initialized = true;
+    IMGPROC_TRACE_COUNTER("agcwdStream.distance", distance);
+
+    if (channels == 1) {
+        cv::LUT(src, table, dst);
+    }
+    else {
+        applyValueLUT(src, dst, table);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <opencv2/core.hpp>
+
+// AGCWD for video and camera preview. The value histogram is smoothed across frames with an
+// exponential moving average, and the gamma table is only rebuilt once the smoothed
+// histogram has drifted from the one the current table was built from by more than
+// `threshold` (total variation distance, 0..1). Otherwise the previous table is reused, which
+// leaves one histogram pass and the LUT apply per frame and keeps the preview from flickering.
+class StreamingAGCWD
+{
+public:
+    // smoothing: weight of the newest frame in the moving average (1 = no smoothing).
+    explicit StreamingAGCWD(double alpha = 0.5, double smoothing = 0.2, double threshold = 0.02);
+
+    // Same contract as AGCWD(): an RGBA dst of the right size is written in place.
+    void process(const cv::Mat& src, cv::Mat& dst);
+
+    // Forgets the history, e.g. after a scene cut or a camera switch.
+    void reset();
+
+    // Whether the last process() call rebuilt the table.
+    bool tableRebuilt() const { return rebuilt; }
+
+private:
+    double alpha;
+    double smoothing;
+    double threshold;
+    bool initialized;
+    bool rebuilt;
+    std::array<double, 256> pdf;        // smoothed normalised histogram
+    std::array<double, 256> tablePdf;   // pdf the current table was built from
+    std::array<uchar, 256> table;
+};
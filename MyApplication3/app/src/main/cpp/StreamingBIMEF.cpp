@@ -0,0 +1,12 @@
+#include "StreamingBIMEF.h"
+#include "BIMEF_Trial.h"
+#include "Trace.h"
+
+void StreamingBIMEF::process(const cv::Mat& input, cv::Mat& output, EnhanceBuffers& buffers)
+{
+    IMGPROC_TRACE_SCOPE("StreamingBIMEF");
+    // The warm start pays off most with the multigrid solver, whose iteration count barely
+    // depends on the resolution; this mode is new, so it has no IC results to keep.
+    BIMEF(input, output, buffers, &state, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID);
+    IMGPROC_TRACE_COUNTER("bimefStream.iterations", state.iterations);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+struct EnhanceBuffers;
+
+// What BIMEF carries from one video frame to the next.
+struct BIMEFWarmStart
+{
+    BIMEFWarmStart() : k(0), iterations(0) {}
+
+    std::vector<float> illumination;   // last illumination solve (column-major) at `size`
+    cv::Size size;
+    float k;                           // last exposure ratio, 0 before the first frame
+    int iterations;                    // CG iterations of the last frame
+};
+
+// BIMEF for video and camera preview. The illumination map of consecutive frames barely
+// changes, so the previous frame's solution is used as is (no motion compensation: the map
+// is heavily smoothed and computed at half resolution) as the initial guess of the CG solve,
+// which then often needs only a few iterations or none at all. The exposure ratio k is
+// searched near the previous one instead of over the whole [1, 7] range.
+class StreamingBIMEF
+{
+public:
+    // Same contract as BIMEF(): an RGBA output of the right size is written in place.
+    void process(const cv::Mat& input, cv::Mat& output, EnhanceBuffers& buffers);
+
+    // Forgets the previous frame, e.g. after a scene cut or a camera switch.
+    void reset() { state = BIMEFWarmStart(); }
+
+    // CG iterations of the last process() call.
+    int iterations() const { return state.iterations; }
+    float exposureRatio() const { return state.k; }
+
+private:
+    BIMEFWarmStart state;
+};
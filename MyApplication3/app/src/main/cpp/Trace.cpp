@@ -0,0 +1,116 @@
+#include "Trace.h"
+
+#ifdef IMGPROC_ENABLE_TRACE
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace imgproc_trace {
+
+struct Event
+{
+    const char* name;
+    int64_t ts;       // start, microseconds
+    int64_t dur;      // duration, microseconds; -1 for counters
+    double value;     // counter value
+};
+
+// Events are appended to a buffer owned by the recording thread, so trace points only take
+// their own uncontended lock. The registry lock is taken once per thread and on export.
+struct ThreadBuffer
+{
+    int tid;
+    std::mutex mutex;
+    std::vector<Event> events;
+};
+
+static std::mutex registryMutex;
+static std::vector<std::shared_ptr<ThreadBuffer> > registry;
+
+static ThreadBuffer& threadBuffer()
+{
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        buffer->events.reserve(1024);
+        std::lock_guard<std::mutex> lock(registryMutex);
+        buffer->tid = static_cast<int>(registry.size()) + 1;
+        registry.push_back(buffer);
+    }
+    return *buffer;
+}
+
+int64_t nowMicros()
+{
+    static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void complete(const char* name, int64_t startMicros, int64_t endMicros)
+{
+    ThreadBuffer& buffer = threadBuffer();
+    Event e = { name, startMicros, endMicros - startMicros, 0.0 };
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(e);
+}
+
+void counter(const char* name, double value)
+{
+    ThreadBuffer& buffer = threadBuffer();
+    Event e = { name, nowMicros(), -1, value };
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(e);
+}
+
+bool exportJson(const char* path)
+{
+    FILE* f = std::fopen(path, "w");
+    if (!f) return false;
+
+    std::fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    std::lock_guard<std::mutex> registryLock(registryMutex);
+    for (size_t t = 0; t < registry.size(); t++) {
+        ThreadBuffer& buffer = *registry[t];
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        for (size_t i = 0; i < buffer.events.size(); i++) {
+            const Event& e = buffer.events[i];
+            if (e.dur >= 0) {
+                std::fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, \"dur\": %lld}",
+                             first ? "" : ",\n", e.name, buffer.tid, (long long)e.ts, (long long)e.dur);
+            } else {
+                std::fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, \"args\": {\"value\": %.9g}}",
+                             first ? "" : ",\n", e.name, buffer.tid, (long long)e.ts, e.value);
+            }
+            first = false;
+        }
+    }
+    std::fprintf(f, "\n]}\n");
+    return std::fclose(f) == 0;
+}
+
+const char* intern(const std::string& name)
+{
+    // std::set never moves its elements, so the pointers stay valid.
+    static std::mutex poolMutex;
+    static std::set<std::string> pool;
+    std::lock_guard<std::mutex> lock(poolMutex);
+    return pool.insert(name).first->c_str();
+}
+
+void clear()
+{
+    std::lock_guard<std::mutex> registryLock(registryMutex);
+    for (size_t t = 0; t < registry.size(); t++) {
+        std::lock_guard<std::mutex> lock(registry[t]->mutex);
+        registry[t]->events.clear();
+    }
+}
+
+} // namespace imgproc_trace
+
+#endif
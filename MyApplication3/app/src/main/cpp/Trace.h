@@ -0,0 +1,68 @@
+#pragma once
+
+// Scoped trace points and counters, exportable as Chrome / Perfetto trace JSON.
+// Compiled in only when IMGPROC_ENABLE_TRACE is defined (CMake option IMGPROC_TRACE);
+// otherwise every macro expands to nothing. Events keep the name pointer until export, so
+// names must be string literals, or go through the _COPY variant.
+//
+//   IMGPROC_TRACE_SCOPE("cg.solve");            // duration event until the end of the scope
+//   IMGPROC_TRACE_SCOPE_COPY(step.name);        // the same for a name built at run time
+//   IMGPROC_TRACE_BEGIN(assemble);              // explicit span, for stages that do not
+//   ...                                         // map onto a C++ scope
+//   IMGPROC_TRACE_END(assemble, "assemble");
+//   IMGPROC_TRACE_COUNTER("cg.iterations", n);  // counter sample
+//   IMGPROC_TRACE_EXPORT("/sdcard/trace.json"); // writes all recorded events, true on success
+
+#ifdef IMGPROC_ENABLE_TRACE
+
+#include <cstdint>
+#include <string>
+
+namespace imgproc_trace {
+
+int64_t nowMicros();
+void complete(const char* name, int64_t startMicros, int64_t endMicros);
+void counter(const char* name, double value);
+bool exportJson(const char* path);
+void clear();
+// Copy of `name` that lives as long as the process; equal names share one copy.
+const char* intern(const std::string& name);
+
+class Scope
+{
+public:
+    explicit Scope(const char* name) : name(name), start(nowMicros()) {}
+    ~Scope() { complete(name, start, nowMicros()); }
+
+private:
+    Scope(const Scope&);
+    Scope& operator=(const Scope&);
+
+    const char* name;
+    int64_t start;
+};
+
+} // namespace imgproc_trace
+
+#define IMGPROC_TRACE_CONCAT_(a, b) a##b
+#define IMGPROC_TRACE_CONCAT(a, b) IMGPROC_TRACE_CONCAT_(a, b)
+#define IMGPROC_TRACE_SCOPE(name) imgproc_trace::Scope IMGPROC_TRACE_CONCAT(imgprocTraceScope, __LINE__)(name)
+#define IMGPROC_TRACE_SCOPE_COPY(name) \
+    imgproc_trace::Scope IMGPROC_TRACE_CONCAT(imgprocTraceScope, __LINE__)(imgproc_trace::intern(name))
+#define IMGPROC_TRACE_BEGIN(id) const int64_t imgprocTraceBegin_##id = imgproc_trace::nowMicros()
+#define IMGPROC_TRACE_END(id, name) imgproc_trace::complete(name, imgprocTraceBegin_##id, imgproc_trace::nowMicros())
+#define IMGPROC_TRACE_COUNTER(name, value) imgproc_trace::counter(name, static_cast<double>(value))
+#define IMGPROC_TRACE_EXPORT(path) imgproc_trace::exportJson(path)
+#define IMGPROC_TRACE_CLEAR() imgproc_trace::clear()
+
+#else
+
+#define IMGPROC_TRACE_SCOPE(name) do {} while (0)
+#define IMGPROC_TRACE_SCOPE_COPY(name) do {} while (0)
+#define IMGPROC_TRACE_BEGIN(id) do {} while (0)
+#define IMGPROC_TRACE_END(id, name) do {} while (0)
+#define IMGPROC_TRACE_COUNTER(name, value) do {} while (0)
+#define IMGPROC_TRACE_EXPORT(path) false
+#define IMGPROC_TRACE_CLEAR() do {} while (0)
+
+#endif
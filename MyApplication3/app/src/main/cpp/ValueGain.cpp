@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "ValueGain.h"
+
+void applyValueLUT(const cv::Mat& src, cv::Mat& dst, const std::array<uchar, 256>& lut)
+{
+    CV_Assert( src.type() == CV_8UC3 || src.type() == CV_8UC4 );
+    if (dst.size() != src.size() || dst.type() != CV_8UC4)
+    {
+        dst.create(src.size(), CV_8UC3);
+    }
+
+    // gain[v] = lut[v] / v, so that channel v maps exactly onto lut[v].
+    std::array<uint32_t, 256> gain;
+    gain[0] = 0;
+    for (int v = 1; v < 256; v++) {
+        gain[v] = ((uint32_t)lut[v] * 65536u + v / 2) / v;
+    }
+    const uchar black = lut[0];
+
+    const int scn = src.channels();
+    const int dcn = dst.channels();
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+        for (int i = range.start; i < range.end; i++)
+        {
+            const uchar* s = src.ptr<uchar>(i);
+            uchar* d = dst.ptr<uchar>(i);
+            for (int j = 0; j < src.cols; j++, s += scn, d += dcn)
+            {
+                const uchar c0 = s[0], c1 = s[1], c2 = s[2];
+                const uchar alpha = scn == 4 ? s[3] : 255;
+                const int v = std::max(c0, std::max(c1, c2));
+                if (v == 0)
+                {
+                    d[0] = d[1] = d[2] = black;
+                }
+                else
+                {
+                    const uint32_t g = gain[v];
+                    d[0] = (uchar)std::min<uint32_t>(255u, (c0 * g + 32768u) >> 16);
+                    d[1] = (uchar)std::min<uint32_t>(255u, (c1 * g + 32768u) >> 16);
+                    d[2] = (uchar)std::min<uint32_t>(255u, (c2 * g + 32768u) >> 16);
+                }
+                if (dcn == 4)
+                {
+                    d[3] = alpha;
+                }
+            }
+        }
+    });
+}
+
+void applyValueLUT16(const cv::Mat& src, cv::Mat& dst, const std::vector<ushort>& lut)
+{
+    const int cn = src.channels();
+    CV_Assert( src.depth() == CV_16U && (cn == 1 || cn == 3 || cn == 4) );
+    CV_Assert( !lut.empty() && lut.size() <= 65536 );
+    dst.create(src.size(), src.type());
+
+    // gain[v] = lut[v] / v in 16.16; lut[v] * 65536 < 2^32, so it fits 32 bits.
+    const int maxIndex = (int)lut.size() - 1;
+    std::vector<uint32_t> gain(lut.size());
+    gain[0] = 0;
+    for (int v = 1; v <= maxIndex; v++) {
+        gain[v] = (uint32_t)(((uint64_t)lut[v] * 65536u + v / 2) / v);
+    }
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+    {
+        for (int i = range.start; i < range.end; i++)
+        {
+            const ushort* s = src.ptr<ushort>(i);
+            ushort* d = dst.ptr<ushort>(i);
+            for (int j = 0; j < src.cols; j++, s += cn, d += cn)
+            {
+                if (cn == 1)
+                {
+                    d[0] = lut[std::min<int>(s[0], maxIndex)];
+                    continue;
+                }
+                const ushort c0 = s[0], c1 = s[1], c2 = s[2];
+                const int v = std::min<int>(std::max(c0, std::max(c1, c2)), maxIndex);
+                if (v == 0)
+                {
+                    d[0] = d[1] = d[2] = lut[0];
+                }
+                else
+                {
+                    // Channels above v (only possible when clamped to the table) scale too.
+                    const uint64_t g = gain[v];
+                    d[0] = (ushort)std::min<uint64_t>(65535u, (c0 * g + 32768u) >> 16);
+                    d[1] = (ushort)std::min<uint64_t>(65535u, (c1 * g + 32768u) >> 16);
+                    d[2] = (ushort)std::min<uint64_t>(65535u, (c2 * g + 32768u) >> 16);
+                }
+                if (cn == 4)
+                {
+                    d[3] = s[3];
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Applies `lut` to the HSV value V = max(c0, c1, c2) of every pixel while keeping hue and
+// saturation, in one pass and without an HSV round trip: each colour channel is scaled by
+// lut[V] / V in 16.16 fixed point. Channel order (BGR, RGBA, ...) does not matter.
+//
+// src is 8-bit with 3 or 4 channels and may be the same Mat as dst. An RGBA dst of the right
+// size is written in place (alpha copied from src, or 255), otherwise dst gets 3 channels.
+// Matches cvtColor(HSV_FULL) / LUT on V / cvtColor back within rounding.
+void applyValueLUT(const cv::Mat& src, cv::Mat& dst, const std::array<uchar, 256>& lut);
+
+// The same for CV_16U images with 1, 3 or 4 channels and a table of up to 65536 entries;
+// values beyond the table use its last entry. dst gets the type of src (1 channel: plain LUT).
+void applyValueLUT16(const cv::Mat& src, cv::Mat& dst, const std::vector<ushort>& lut);
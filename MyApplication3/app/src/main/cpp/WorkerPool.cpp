@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "WorkerPool.h"
+
+Eigen::ThreadPool& workerPool()
+{
+    static Eigen::ThreadPool pool(std::max(1, (int)std::thread::hardware_concurrency()));
+    return pool;
+}
+
+EnhanceSession& workerSession()
+{
+    static std::vector<EnhanceSession> sessions(workerPool().NumThreads());
+    int id = workerPool().CurrentThreadId();
+    CV_Assert( id >= 0 );
+    return sessions[id];
+}
+
+// Single-image requests get their own threads, so that the parallelFor() calls inside them
+// are not run inline but split over the whole worker pool.
+static const int kAsyncThreads = 2;
+
+static Eigen::ThreadPool& asyncPool()
+{
+    static Eigen::ThreadPool pool(kAsyncThreads);
+    return pool;
+}
+
+EnhanceSession& asyncSession()
+{
+    static std::vector<EnhanceSession> sessions(kAsyncThreads);
+    int id = asyncPool().CurrentThreadId();
+    CV_Assert( id >= 0 );
+    return sessions[id];
+}
+
+int parallelBlocks(int n, int grain)
+{
+    if (n <= 0) return 0;
+    const int blocks = n / std::max(grain, 1);
+    return std::max(1, std::min(blocks, workerPool().NumThreads()));
+}
+
+void parallelFor(int n, int grain, const std::function<void(int, int, int)>& fn)
+{
+    const int blocks = parallelBlocks(n, grain);
+    auto range = [&](int b, int& begin, int& end) {
+        begin = (int)((long long)n * b / blocks);
+        end = (int)((long long)n * (b + 1) / blocks);
+    };
+    if (blocks <= 1 || workerPool().CurrentThreadId() >= 0) {
+        for (int b = 0; b < blocks; b++) {
+            int begin, end;
+            range(b, begin, end);
+            fn(b, begin, end);
+        }
+        return;
+    }
+
+    Eigen::Barrier barrier(static_cast<unsigned int>(blocks - 1));
+    for (int b = 1; b < blocks; b++) {
+        workerPool().Schedule([&, b]() {
+            int begin, end;
+            range(b, begin, end);
+            fn(b, begin, end);
+            barrier.Notify();
+        });
+    }
+    int begin, end;
+    range(0, begin, end);
+    fn(0, begin, end);
+    barrier.Wait();
+}
+
+static std::mutex asyncMutex;
+static std::map<int, int> asyncStatus;
+static int asyncNextId = 1;
+
+int submitAsync(std::function<bool()> job, std::function<bool(int, bool)> done)
+{
+    int id;
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        id = asyncNextId++;
+        asyncStatus[id] = ASYNC_PENDING;
+    }
+    asyncPool().Schedule([id, job, done]() {
+        bool ok = false;
+        try {
+            ok = job();
+        } catch (...) {
+            ok = false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(asyncMutex);
+            asyncStatus[id] = ok ? ASYNC_DONE : ASYNC_FAILED;
+        }
+        // Once a callback has been told, nobody is expected to poll for the request any more;
+        // otherwise the status waits for pollAsync().
+        if (done && done(id, ok)) {
+            std::lock_guard<std::mutex> lock(asyncMutex);
+            asyncStatus.erase(id);
+        }
+    });
+    return id;
+}
+
+int pollAsync(int requestId)
+{
+    std::lock_guard<std::mutex> lock(asyncMutex);
+    std::map<int, int>::iterator it = asyncStatus.find(requestId);
+    if (it == asyncStatus.end()) return ASYNC_UNKNOWN;
+    int status = it->second;
+    if (status != ASYNC_PENDING) asyncStatus.erase(it);
+    return status;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include "eigen/unsupported/Eigen/CXX11/ThreadPool"
+#include "EnhanceSession.h"
+
+// Fixed pool of native worker threads (one per core) shared by the asynchronous and batch
+// entry points. Eigen's NonBlockingThreadPool keeps a queue per thread and steals work
+// between them.
+Eigen::ThreadPool& workerPool();
+
+// Session private to the calling pool thread, so concurrent jobs never share buffers.
+// Must only be called from a job running on workerPool().
+EnhanceSession& workerSession();
+
+// Session private to the calling submitAsync() job thread. Must only be called from a job.
+EnhanceSession& asyncSession();
+
+// Scratch memory a pool or asyncSession() may keep from one job to the next; jobs pass it to
+// trimSession() when they are done. Enough for a few megapixels of BIMEF temporaries, so
+// the usual photo sizes still run without heap allocation, while a 12 MP frame (about
+// 450 MB) is not kept once per core.
+static const size_t kWorkerSessionBytes = (size_t)128 << 20;
+
+// Number of blocks parallelFor() splits [0, n) into: one per pool thread, but none smaller
+// than `grain` items. Depends only on n, grain and the pool size, so reductions over the
+// blocks add up in the same order on every run.
+int parallelBlocks(int n, int grain);
+
+// Calls fn(block, begin, end) for each of the parallelBlocks(n, grain) blocks of [0, n),
+// on the pool and the calling thread, and returns when all are done. Called from a pool
+// thread (a batch job, which already has the pool busy), everything runs inline instead,
+// since waiting on the pool from inside it could deadlock. fn must not throw.
+void parallelFor(int n, int grain, const std::function<void(int, int, int)>& fn);
+
+enum AsyncStatus
+{
+    ASYNC_UNKNOWN = -1,
+    ASYNC_PENDING = 0,
+    ASYNC_DONE = 1,
+    ASYNC_FAILED = 2
+};
+
+// Schedules `job` and returns its request id. Jobs run on a few threads of their own rather
+// than on the worker pool, so the algorithms inside can still spread over the whole pool;
+// they use asyncSession(). `job` returns whether it succeeded; `done` (optional) is then
+// called on the same thread and returns whether
+// it delivered the result to the client, in which case the status is not kept for polling.
+int submitAsync(std::function<bool()> job, std::function<bool(int, bool)> done);
+
+// Status of a submitted request. Finished requests are forgotten once they have been polled,
+// or once their `done` callback has reported delivering the result.
+int pollAsync(int requestId);
@@ -0,0 +1,446 @@
+// Benchmark of every enhancement algorithm across resolutions, built on Eigen's BenchTimer.
+//
+//   imageproc_bench [--algorithms A,B,...] [--sizes VGA,1080p,12MP,48MP] [--warmup N]
+//                   [--reps N] [--image file]... [--json out.json]
+//
+// Each algorithm runs on a synthetic low-light frame at every size, plus every --image
+// resized to every size. Wall-clock times of the repetitions are reported as min / mean /
+// percentiles, as a table on stdout and optionally as JSON. The AGCIE/stepN and AGCWD/stepN
+// entries use sampled histograms and add their estimation errors and LUT differences to the
+// JSON "extra" object. BIMEF/jacobi and BIMEF/multigrid add their output differences to the
+// default (IC) BIMEF, BIMEF/half and BIMEF/tile512 theirs to float, whole-image multigrid;
+// BIMEF/tile512 also that of the smoothed illumination map t.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <bench/BenchTimer.h>
+
+#include "AGCIE.h"
+#include "AGCWD.h"
+#include "BIMEF_Trial.h"
+#include "Enhance.h"
+#include "EnhanceSession.h"
+#include "Histogram.h"
+#include "intensity_transform.h"
+
+struct BenchSize
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+static const BenchSize benchSizes[] = {
+    { "VGA", 640, 480 },
+    { "1080p", 1920, 1080 },
+    { "12MP", 4000, 3000 },
+    { "48MP", 8000, 6000 },
+};
+
+struct BenchInput
+{
+    std::string name;
+    std::string size;
+    cv::Mat image;
+};
+
+struct BenchAlgorithm
+{
+    std::string name;
+    std::function<void(const cv::Mat&, cv::Mat&)> run;
+    // Optional, called once per input after timing to fill BenchResult::extra.
+    std::function<void(const cv::Mat&, std::map<std::string, double>&)> metrics;
+};
+
+struct BenchResult
+{
+    std::string algorithm;
+    std::string input;
+    std::string size;
+    int width;
+    int height;
+    std::vector<double> ms;
+    std::map<std::string, double> extra;   // algorithm specific metrics, reported as-is
+};
+
+// Dark frame with a smooth illumination falloff, texture and sensor-like noise. Deterministic,
+// so runs are comparable across builds and devices.
+static cv::Mat syntheticLowLight(int width, int height)
+{
+    cv::Mat img(height, width, CV_8UC3);
+    unsigned int seed = 12345;
+    for (int i = 0; i < height; i++) {
+        cv::Vec3b* row = img.ptr<cv::Vec3b>(i);
+        float y = (float)i / height;
+        for (int j = 0; j < width; j++) {
+            float x = (float)j / width;
+            float illum = 0.04f + 0.4f * x * (1.0f - 0.5f * y);
+            float texture = 0.6f + 0.4f * (((i / 16 + j / 16) & 1) ? 1.0f : 0.5f);
+            seed = seed * 1664525u + 1013904223u;
+            float noise = ((seed >> 24) / 255.0f - 0.5f) * 0.03f;
+            float v = (illum * texture + noise) * 255.0f;
+            row[j][0] = cv::saturate_cast<uchar>(v * 0.8f);
+            row[j][1] = cv::saturate_cast<uchar>(v);
+            row[j][2] = cv::saturate_cast<uchar>(v * 0.9f);
+        }
+    }
+    return img;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+static bool selected(const std::vector<std::string>& filter, const std::string& name)
+{
+    return filter.empty() || std::find(filter.begin(), filter.end(), name) != filter.end();
+}
+
+static int maxTableDiff(const std::array<uchar, 256>& a, const std::array<uchar, 256>& b)
+{
+    int diff = 0;
+    for (int i = 0; i < 256; i++) diff = std::max(diff, std::abs(a[i] - b[i]));
+    return diff;
+}
+
+// Accuracy of a histogram sampled at `step` against the full one: observed errors of mu,
+// sigma and the CDF next to their bounds, and how far the AGCIE / AGCWD tables move.
+static void samplingMetrics(const cv::Mat& src, int step, std::map<std::string, double>& extra)
+{
+    Histogram256 full, sampled;
+    histogramMaxRGB(src, full);
+    histogramMaxRGB(src, sampled, true, step);
+
+    double mu, sigma, muS, sigmaS;
+    histogramMeanStdDev(full, mu, sigma);
+    histogramMeanStdDev(sampled, muS, sigmaS);
+
+    const double n = (double)histogramCount(full), nS = (double)histogramCount(sampled);
+    std::array<double, 256> pdf, pdfS;
+    double cdf = 0, cdfS = 0, cdfErr = 0;
+    for (int i = 0; i < 256; i++) {
+        pdf[i] = full[i] / n;
+        pdfS[i] = sampled[i] / nS;
+        cdf += pdf[i];
+        cdfS += pdfS[i];
+        cdfErr = std::max(cdfErr, std::abs(cdf - cdfS));
+    }
+    SamplingErrorBound bound = histogramErrorBound((size_t)nS);
+
+    std::array<uchar, 256> table, tableS;
+    AGCIETable(mu, sigma, table);
+    AGCIETable(muS, sigmaS, tableS);
+    extra["agcie_lut_max_diff"] = maxTableDiff(table, tableS);
+    AGCWDTable(pdf, 0.5, table);
+    AGCWDTable(pdfS, 0.5, tableS);
+    extra["agcwd_lut_max_diff"] = maxTableDiff(table, tableS);
+
+    extra["samples"] = nS;
+    extra["mu_err"] = std::abs(mu - muS);
+    extra["mu_bound"] = bound.mean;
+    extra["sigma_err"] = std::abs(sigma - sigmaS);
+    extra["sigma_bound"] = bound.stddev;
+    extra["cdf_err"] = cdfErr;
+    extra["cdf_bound"] = bound.cdf;
+}
+
+// Output of BIMEF with half storage against float storage: PSNR, largest difference in
+// levels, share of differing channel values, and the arena peak of float storage (the
+// entry's own arena_peak_bytes is that of half storage).
+static void halfStorageMetrics(const cv::Mat& src, std::map<std::string, double>& extra)
+{
+    EnhanceBuffers buffers;
+    cv::Mat ref, out;
+    BIMEF(src, ref, buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID, BIMEF_STORAGE_FLOAT);
+    extra["float_arena_peak_bytes"] = (double)buffers.arena.peakBytes();
+    BIMEF(src, out, buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID, BIMEF_STORAGE_HALF);
+
+    double maxDiff;
+    cv::Mat diff;
+    cv::absdiff(ref, out, diff);
+    cv::minMaxLoc(diff.reshape(1), nullptr, &maxDiff);
+    extra["psnr_db"] = cv::PSNR(ref, out);
+    extra["max_abs_diff"] = maxDiff;
+    extra["differing_fraction"] = (double)cv::countNonZero(diff.reshape(1)) / (double)diff.total() / diff.channels();
+}
+
+// Output of BIMEF with a matrix-free solver against the default IC solver: PSNR, largest
+// difference in levels and share of differing channel values.
+static void solverMetrics(const cv::Mat& src, BIMEFSolver solver, std::map<std::string, double>& extra)
+{
+    EnhanceBuffers buffers;
+    cv::Mat ref, out;
+    BIMEF(src, ref, buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_IC);
+    BIMEF(src, out, buffers, 0.5f, -0.3293f, 1.1258f, solver);
+
+    double maxDiff;
+    cv::Mat diff;
+    cv::absdiff(ref, out, diff);
+    cv::minMaxLoc(diff.reshape(1), nullptr, &maxDiff);
+    extra["psnr_db"] = cv::PSNR(ref, out);
+    extra["max_abs_diff"] = maxDiff;
+    extra["differing_fraction"] = (double)cv::countNonZero(diff.reshape(1)) / (double)diff.total() / diff.channels();
+}
+
+// Output and illumination map t of BIMEF with the illumination smoothed in tiles against the
+// whole-image solve, and the largest tile arena next to the arena of the whole-image solve.
+static void tiledMetrics(const cv::Mat& src, int tileSize, std::map<std::string, double>& extra)
+{
+    EnhanceBuffers buffers;
+    cv::Mat ref, out;
+    BIMEF(src, ref, buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID);
+    extra["untiled_arena_peak_bytes"] = (double)buffers.arena.peakBytes();
+    BIMEF(src, out, buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID, BIMEF_STORAGE_FLOAT, tileSize);
+    size_t tilePeak = 0;
+    for (const FrameArena& arena : buffers.tileArenas) tilePeak = std::max(tilePeak, arena.peakBytes());
+    extra["tile_arena_peak_bytes"] = (double)tilePeak;
+    extra["tile_arenas"] = (double)buffers.tileArenas.size();
+
+    double maxDiff;
+    cv::Mat diff;
+    cv::absdiff(ref, out, diff);
+    cv::minMaxLoc(diff.reshape(1), nullptr, &maxDiff);
+    extra["psnr_db"] = cv::PSNR(ref, out);
+    extra["max_abs_diff"] = maxDiff;
+
+    cv::Mat_<float> tRef, tTiled;
+    BIMEFIllumination(src, tRef, buffers, BIMEF_SOLVER_MULTIGRID);
+    BIMEFIllumination(src, tTiled, buffers, BIMEF_SOLVER_MULTIGRID, tileSize);
+    extra["t_max_abs_diff"] = cv::norm(tRef, tTiled, cv::NORM_INF);
+    extra["t_mean_abs_diff"] = cv::norm(tRef, tTiled, cv::NORM_L1) / (double)tRef.total();
+}
+
+static std::vector<BenchAlgorithm> benchAlgorithms(EnhanceSession& session)
+{
+    std::vector<BenchAlgorithm> algorithms;
+    for (int i = 0; i < ENHANCE_ALGORITHM_COUNT; i++) {
+        algorithms.push_back({ enhanceAlgorithmName(i), [i, &session](const cv::Mat& src, cv::Mat& dst) {
+            enhance(i, src, dst, session);
+        } });
+    }
+    // Sampled-histogram variants, reported with their accuracy against the full histogram.
+    for (int step : { 2, 4, 8, 16 }) {
+        std::string suffix = "/step" + std::to_string(step);
+        auto metrics = [step](const cv::Mat& src, std::map<std::string, double>& extra) {
+            samplingMetrics(src, step, extra);
+        };
+        algorithms.push_back({ "AGCIE" + suffix, [step, &session](const cv::Mat& src, cv::Mat& dst) {
+            AGCIE(src, dst, session.buffers, step);
+        }, metrics });
+        algorithms.push_back({ "AGCWD" + suffix, [step, &session](const cv::Mat& src, cv::Mat& dst) {
+            AGCWD(src, dst, session.buffers, 0.5, step);
+        }, metrics });
+    }
+    // The matrix-free solvers of the illumination smoothing, reported with their output
+    // difference to the default IC solver.
+    algorithms.push_back({ "BIMEF/jacobi", [&session](const cv::Mat& src, cv::Mat& dst) {
+        BIMEF(src, dst, session.buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MATRIX_FREE);
+    }, [](const cv::Mat& src, std::map<std::string, double>& extra) {
+        solverMetrics(src, BIMEF_SOLVER_MATRIX_FREE, extra);
+    } });
+    algorithms.push_back({ "BIMEF/multigrid", [&session](const cv::Mat& src, cv::Mat& dst) {
+        BIMEF(src, dst, session.buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID);
+    }, [](const cv::Mat& src, std::map<std::string, double>& extra) {
+        solverMetrics(src, BIMEF_SOLVER_MULTIGRID, extra);
+    } });
+    // Half-precision storage of the full-resolution maps, reported with its output difference
+    // to float storage (both with the multigrid solver).
+    algorithms.push_back({ "BIMEF/half", [&session](const cv::Mat& src, cv::Mat& dst) {
+        BIMEF(src, dst, session.buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID, BIMEF_STORAGE_HALF);
+    }, halfStorageMetrics });
+    // Tiled smoothing, reported with its output difference to the whole-image solve (both with
+    // the multigrid solver).
+    algorithms.push_back({ "BIMEF/tile512", [&session](const cv::Mat& src, cv::Mat& dst) {
+        BIMEF(src, dst, session.buffers, 0.5f, -0.3293f, 1.1258f, BIMEF_SOLVER_MULTIGRID, BIMEF_STORAGE_FLOAT, 512);
+    }, [](const cv::Mat& src, std::map<std::string, double>& extra) {
+        tiledMetrics(src, 512, extra);
+    } });
+    algorithms.push_back({ "gammaCorrection", [](const cv::Mat& src, cv::Mat& dst) {
+        cv::intensity_transform::gammaCorrection(src, dst, 0.5f);
+    } });
+    algorithms.push_back({ "logTransform", [](const cv::Mat& src, cv::Mat& dst) {
+        cv::intensity_transform::logTransform(src, dst);
+    } });
+    algorithms.push_back({ "autoscaling", [](const cv::Mat& src, cv::Mat& dst) {
+        cv::intensity_transform::autoscaling(src, dst);
+    } });
+    algorithms.push_back({ "contrastStretching", [](const cv::Mat& src, cv::Mat& dst) {
+        cv::intensity_transform::contrastStretching(src, dst, 70, 15, 120, 240);
+    } });
+    return algorithms;
+}
+
+static void writeJson(FILE* f, const std::vector<BenchResult>& results, int warmup)
+{
+    std::fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (size_t r = 0; r < results.size(); r++) {
+        const BenchResult& res = results[r];
+        std::vector<double> sorted = res.ms;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0;
+        for (double v : sorted) mean += v;
+        mean /= std::max<size_t>(1, sorted.size());
+
+        std::fprintf(f, "    {\"algorithm\": \"%s\", \"input\": \"%s\", \"size\": \"%s\", \"width\": %d, \"height\": %d, "
+                        "\"warmup\": %d, \"repetitions\": %d,\n",
+                     res.algorithm.c_str(), res.input.c_str(), res.size.c_str(), res.width, res.height,
+                     warmup, (int)res.ms.size());
+        std::fprintf(f, "     \"ms\": {\"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+                     sorted.empty() ? 0 : sorted.front(), mean, percentile(sorted, 50), percentile(sorted, 90),
+                     percentile(sorted, 99), sorted.empty() ? 0 : sorted.back());
+        std::fprintf(f, "     \"samples_ms\": [");
+        for (size_t i = 0; i < res.ms.size(); i++) {
+            std::fprintf(f, "%s%.4f", i ? ", " : "", res.ms[i]);
+        }
+        std::fprintf(f, "],\n     \"extra\": {");
+        bool first = true;
+        for (const auto& kv : res.extra) {
+            std::fprintf(f, "%s\"%s\": %.6g", first ? "" : ", ", kv.first.c_str(), kv.second);
+            first = false;
+        }
+        std::fprintf(f, "}}%s\n", r + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "  ]\n}\n");
+}
+
+static void usage()
+{
+    std::fprintf(stderr, "usage: imageproc_bench [--algorithms A,B,...] [--sizes VGA,1080p,12MP,48MP] [--warmup N]\n"
+                         "                       [--reps N] [--image file]... [--json out.json]\n");
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> algorithmFilter, sizeFilter, images;
+    std::string jsonPath;
+    int warmup = 1;
+    int reps = 5;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        if (arg == "--algorithms") algorithmFilter = splitList(argv[++i]);
+        else if (arg == "--sizes") sizeFilter = splitList(argv[++i]);
+        else if (arg == "--warmup") warmup = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--reps") reps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--image") images.push_back(argv[++i]);
+        else if (arg == "--json") jsonPath = argv[++i];
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    std::vector<BenchInput> inputs;
+    std::vector<cv::Mat> realImages;
+    for (const std::string& path : images) {
+        cv::Mat img = cv::imread(path, cv::IMREAD_COLOR);
+        if (img.empty()) {
+            std::fprintf(stderr, "cannot read %s\n", path.c_str());
+            return 1;
+        }
+        realImages.push_back(img);
+    }
+    for (const BenchSize& size : benchSizes) {
+        if (!selected(sizeFilter, size.name)) continue;
+        inputs.push_back({ "synthetic", size.name, syntheticLowLight(size.width, size.height) });
+        for (size_t k = 0; k < realImages.size(); k++) {
+            BenchInput input = { images[k], size.name, cv::Mat() };
+            cv::resize(realImages[k], input.image, cv::Size(size.width, size.height), 0, 0, cv::INTER_AREA);
+            inputs.push_back(input);
+        }
+    }
+
+    EnhanceSession session;
+    std::vector<BenchAlgorithm> algorithms = benchAlgorithms(session);
+    std::vector<BenchResult> results;
+
+    std::printf("%-20s %-28s %-6s %10s %10s %10s %10s %10s\n", "algorithm", "input", "size", "min", "mean", "p50", "p90", "max");
+    for (const BenchAlgorithm& algorithm : algorithms) {
+        if (!selected(algorithmFilter, algorithm.name)) continue;
+        for (const BenchInput& input : inputs) {
+            BenchResult res;
+            res.algorithm = algorithm.name;
+            res.input = input.name;
+            res.size = input.size;
+            res.width = input.image.cols;
+            res.height = input.image.rows;
+
+            cv::Mat dst;
+            Eigen::BenchTimer timer;
+            try {
+                for (int i = 0; i < warmup; i++) {
+                    algorithm.run(input.image, dst);
+                }
+                for (int i = 0; i < reps; i++) {
+                    timer.start();
+                    algorithm.run(input.image, dst);
+                    timer.stop();
+                    escape(dst.data);
+                    res.ms.push_back(timer.value(Eigen::REAL_TIMER) * 1000.0);
+                }
+            } catch (const cv::Exception& e) {
+                std::fprintf(stderr, "%s on %s %s failed: %s\n", algorithm.name.c_str(), input.name.c_str(),
+                             input.size.c_str(), e.what());
+                continue;
+            }
+
+            if (algorithm.metrics) {
+                algorithm.metrics(input.image, res.extra);
+            }
+            if (res.algorithm.find("BIMEF") != std::string::npos) {
+                res.extra["arena_peak_bytes"] = (double)session.buffers.arena.peakBytes();
+            }
+
+            std::vector<double> sorted = res.ms;
+            std::sort(sorted.begin(), sorted.end());
+            double mean = 0;
+            for (double v : sorted) mean += v;
+            mean /= sorted.size();
+            std::printf("%-20s %-28s %-6s %10.3f %10.3f %10.3f %10.3f %10.3f\n", res.algorithm.c_str(),
+                        res.input.c_str(), res.size.c_str(), sorted.front(), mean, percentile(sorted, 50),
+                        percentile(sorted, 90), sorted.back());
+            std::fflush(stdout);
+            results.push_back(res);
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        FILE* f = std::fopen(jsonPath.c_str(), "w");
+        if (!f) {
+            std::fprintf(stderr, "cannot write %s\n", jsonPath.c_str());
+            return 1;
+        }
+        writeJson(f, results, warmup);
+        std::fclose(f);
+    }
+    return 0;
+}
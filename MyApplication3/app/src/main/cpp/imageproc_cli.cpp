@@ -0,0 +1,104 @@
+// Command-line front end of imageproc_core, so the algorithms can be run (and profiled with
+// perf, cachegrind or the sanitizers) on a workstation.
+//
+//   imageproc_cli [--bits=<n>] <algorithm> <input> <output> [repeat] [trace.json]
+//
+// <algorithm> is one of AGCIE, AGCWD, BIMEF, AGCIEDSUS, AGCWDDSUS, BIMEFDSUS, AGCWDSTREAM, AGCWDLOCAL, BIMEFSTREAM, or a pipeline
+// description containing '|' such as "downscale:0.25|BIMEF|upscale" (see Pipeline.h).
+// 16-bit inputs are kept at full depth for AGCIE and AGCWD (see AGCIE16) and reduced to 8 bits
+// for everything else. --bits gives the number of significant bits of such inputs (default 16),
+// e.g. 10 or 12 for raw camera data stored in the low bits of a 16-bit PNG.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "Enhance.h"
+#include "EnhanceSession.h"
+#include "Pipeline.h"
+#include "Trace.h"
+
+static int parseAlgorithm(const char* name)
+{
+    for (int i = 0; i < ENHANCE_ALGORITHM_COUNT; i++) {
+        if (std::strcmp(name, enhanceAlgorithmName(i)) == 0) return i;
+    }
+    return -1;
+}
+
+static void usage()
+{
+    std::fprintf(stderr, "usage: imageproc_cli [--bits=<n>] <algorithm> <input> <output> [repeat] [trace.json]\n");
+    std::fprintf(stderr, "algorithms:");
+    for (int i = 0; i < ENHANCE_ALGORITHM_COUNT; i++) {
+        std::fprintf(stderr, " %s", enhanceAlgorithmName(i));
+    }
+    std::fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv)
+{
+    int bitDepth = 16;
+    if (argc > 1 && std::strncmp(argv[1], "--bits=", 7) == 0) {
+        bitDepth = std::atoi(argv[1] + 7);
+        if (bitDepth < 9 || bitDepth > 16) {
+            std::fprintf(stderr, "--bits must be between 9 and 16\n");
+            return 2;
+        }
+        argv++;
+        argc--;
+    }
+    if (argc < 4 || argc > 6) {
+        usage();
+        return 2;
+    }
+    const bool isPipeline = std::strchr(argv[1], '|') != nullptr;
+    int algorithm = isPipeline ? -1 : parseAlgorithm(argv[1]);
+    if (!isPipeline && algorithm < 0) {
+        std::fprintf(stderr, "unknown algorithm: %s\n", argv[1]);
+        usage();
+        return 2;
+    }
+    int repeat = argc >= 5 ? std::atoi(argv[4]) : 1;
+    if (repeat < 1) repeat = 1;
+
+    cv::Mat src = cv::imread(argv[2], cv::IMREAD_COLOR | cv::IMREAD_ANYDEPTH);
+    if (src.empty()) {
+        std::fprintf(stderr, "cannot read %s\n", argv[2]);
+        return 1;
+    }
+    if (src.depth() == CV_16U && algorithm != ENHANCE_AGCIE && algorithm != ENHANCE_AGCWD) {
+        src.convertTo(src, CV_8U, 255.0 / ((1 << bitDepth) - 1));
+    } else if (src.depth() != CV_8U && src.depth() != CV_16U) {
+        src.convertTo(src, CV_8U);
+    }
+
+    EnhanceSession session;
+    cv::Mat dst;
+    try {
+        for (int i = 0; i < repeat; i++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            if (isPipeline) sessionPipeline(session, argv[1]).run(src, dst, session);
+            else enhance(algorithm, src, dst, session, bitDepth);
+            auto end = std::chrono::high_resolution_clock::now();
+            std::printf("%s %dx%d run %d: %.3f ms\n", isPipeline ? argv[1] : enhanceAlgorithmName(algorithm),
+                        src.cols, src.rows, i, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+    } catch (const cv::Exception& e) {
+        std::fprintf(stderr, "%s failed: %s\n", isPipeline ? argv[1] : enhanceAlgorithmName(algorithm), e.what());
+        return 1;
+    }
+
+    if (argc == 6 && !IMGPROC_TRACE_EXPORT(argv[5])) {
+        std::fprintf(stderr, "cannot write %s (is the build configured with IMGPROC_TRACE?)\n", argv[5]);
+    }
+
+    if (!cv::imwrite(argv[3], dst)) {
+        std::fprintf(stderr, "cannot write %s\n", argv[3]);
+        return 1;
+    }
+    return 0;
+}
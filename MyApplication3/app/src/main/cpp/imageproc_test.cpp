@@ -0,0 +1,682 @@
+// Checks of the numerical kernels whose mistakes would not necessarily show in an output image,
+// each against a direct reference:
+//
+//   - SmoothingOperator::assemble (full and lower triangle, pattern reuse) against multiplyAdd,
+//     on degenerate, odd and even sizes;
+//   - the Neumann (non-periodic) SmoothingOperator and its coarsening against the stencil;
+//   - SmoothingCG against Eigen::ConjugateGradient on the assembled matrix, and Eigen's
+//     solver on the SmoothingOperator itself;
+//   - ExposureEntropy against BIMEF's original applyK, 8-bit conversion and calcHist;
+//   - applyValueLUT against the HSV round trip it replaces;
+//   - the histogram engine against calcHist and direct counts, sampled and not;
+//   - fused point steps of a Pipeline against running them one by one;
+//   - FrameArena merging its blocks on reset() and then staying put;
+//   - StreamingAGCWD rebuilding its table on a scene change but not on noise;
+//   - AGCWDLocal against AGCWD with one tile, and brightening a dark region more than it;
+//   - submitAsync() jobs spreading their parallelFor() over the worker pool.
+//
+// Prints every failure and exits non-zero if there was one. Run by ctest.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "eigen/Eigen/Sparse"
+
+#include "AGCWD.h"
+#include "EnhanceSession.h"
+#include "ExposureEntropy.h"
+#include "FrameArena.h"
+#include "Histogram.h"
+#include "Pipeline.h"
+#include "SmoothingCG.h"
+#include "SmoothingMultigrid.h"
+#include "SmoothingOperator.h"
+#include "StreamingAGCWD.h"
+#include "ValueGain.h"
+#include "WorkerPool.h"
+
+static int failures = 0;
+
+#define TEST_CHECK(cond, ...)                                        \
+    do {                                                             \
+        if (!(cond)) {                                               \
+            std::printf("FAILED %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+            std::printf(__VA_ARGS__);                                \
+            std::printf("\n");                                       \
+            failures++;                                              \
+        }                                                            \
+    } while (0)
+
+static cv::Mat_<float> randomPlane(int rows, int cols, float lo, float hi, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(lo, hi);
+    cv::Mat_<float> m(rows, cols);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+            m(i, j) = dist(rng);
+    return m;
+}
+
+static std::vector<float> randomVector(size_t n, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> v(n);
+    for (float& x : v) x = dist(rng);
+    return v;
+}
+
+// max |a - b| / max |b|
+static double relativeDifference(const float* a, const float* b, size_t n)
+{
+    double diff = 0, scale = 1e-30;
+    for (size_t i = 0; i < n; i++)
+    {
+        diff = std::max(diff, (double)std::abs(a[i] - b[i]));
+        scale = std::max(scale, (double)std::abs(b[i]));
+    }
+    return diff / scale;
+}
+
+static void testAssemble()
+{
+    // 1 and 2 make the periodic neighbours coincide, in one or both directions.
+    static const int sizes[][2] = {
+        { 1, 1 }, { 1, 6 }, { 6, 1 }, { 2, 2 }, { 2, 5 }, { 3, 2 }, { 7, 9 }, { 40, 33 }, { 64, 64 },
+    };
+    std::mt19937 rng(1);
+    for (const auto& size : sizes)
+    {
+        const int rows = size[0], cols = size[1];
+        const size_t k = (size_t)rows * cols;
+        FrameArena arena;
+        SmoothingOperator A;
+        A.setWeights(randomPlane(rows, cols, 0.01f, 50.0f, rng), randomPlane(rows, cols, 0.01f, 50.0f, rng),
+                     0.15f, arena);
+        const std::vector<float> x = randomVector(k, rng);
+        const Eigen::Map<const Eigen::VectorXf> xv(x.data(), (Eigen::Index)k);
+
+        std::vector<float> expected(k, 0.0f);
+        A.multiplyAdd(x.data(), expected.data(), 1.0f);
+
+        Eigen::SparseMatrix<float> full, lower;
+        A.assemble(full, false);
+        A.assemble(lower, true);
+        const Eigen::VectorXf yFull = full * xv;
+        const Eigen::VectorXf yLower = lower.selfadjointView<Eigen::Lower>() * xv;
+        TEST_CHECK(relativeDifference(yFull.data(), expected.data(), k) < 1e-5,
+                   "full %dx%d", rows, cols);
+        TEST_CHECK(relativeDifference(yLower.data(), expected.data(), k) < 1e-5,
+                   "lower %dx%d", rows, cols);
+        TEST_CHECK(full.isApprox(Eigen::SparseMatrix<float>(full.transpose())), "symmetric %dx%d", rows, cols);
+
+        // New weights into the existing patterns.
+        SmoothingOperator B;
+        B.setWeights(randomPlane(rows, cols, 0.01f, 50.0f, rng), randomPlane(rows, cols, 0.01f, 50.0f, rng),
+                     0.3f, arena);
+        std::fill(expected.begin(), expected.end(), 0.0f);
+        B.multiplyAdd(x.data(), expected.data(), 1.0f);
+        B.assemble(full, false, true);
+        B.assemble(lower, true, true);
+        const Eigen::VectorXf zFull = full * xv;
+        const Eigen::VectorXf zLower = lower.selfadjointView<Eigen::Lower>() * xv;
+        TEST_CHECK(relativeDifference(zFull.data(), expected.data(), k) < 1e-5,
+                   "full valuesOnly %dx%d", rows, cols);
+        TEST_CHECK(relativeDifference(zLower.data(), expected.data(), k) < 1e-5,
+                   "lower valuesOnly %dx%d", rows, cols);
+    }
+}
+
+// |b - A x| / |b|
+// Without the wrap-around couplings every pixel only talks to its neighbours inside the image:
+// (A x)_p = x_p + sum over in-image neighbours q of lambda w_pq (x_p - x_q), for the tile
+// operators of tsmoothTiled. Coarsening must keep the boundary.
+static void testNeumann()
+{
+    static const int sizes[][2] = { { 1, 6 }, { 7, 9 }, { 40, 33 } };
+    const float lambda = 0.15f;
+    std::mt19937 rng(5);
+    for (const auto& size : sizes)
+    {
+        const int rows = size[0], cols = size[1];
+        const size_t k = (size_t)rows * cols;
+        const cv::Mat_<float> W_h = randomPlane(rows, cols, 0.01f, 50.0f, rng);
+        const cv::Mat_<float> W_v = randomPlane(rows, cols, 0.01f, 50.0f, rng);
+        FrameArena arena;
+        SmoothingOperator A;
+        A.setWeights(W_h, W_v, lambda, arena, false);
+
+        const std::vector<float> x = randomVector(k, rng);
+        std::vector<float> y(k, 0.0f), expected(k);
+        A.multiplyAdd(x.data(), y.data(), 1.0f);
+        for (int j = 0; j < cols; j++)
+            for (int i = 0; i < rows; i++)
+            {
+                const size_t p = (size_t)j * rows + i;
+                double sum = x[p];
+                if (j + 1 < cols) sum += lambda * W_h(i, j) * (x[p] - x[p + rows]);
+                if (j > 0) sum += lambda * W_h(i, j - 1) * (x[p] - x[p - rows]);
+                if (i + 1 < rows) sum += lambda * W_v(i, j) * (x[p] - x[p + 1]);
+                if (i > 0) sum += lambda * W_v(i - 1, j) * (x[p] - x[p - 1]);
+                expected[p] = (float)sum;
+            }
+        TEST_CHECK(relativeDifference(y.data(), expected.data(), k) < 1e-5, "Neumann %dx%d", rows, cols);
+
+        // The coarse operator is P^T A P, P spreading a coarse pixel over its 2x2 aggregate.
+        const SmoothingOperator coarse = A.coarsen(arena);
+        const int rc = coarse.imageRows();
+        const size_t kc = (size_t)coarse.rows();
+        const std::vector<float> xc = randomVector(kc, rng);
+        std::vector<float> xf(k), yf(k, 0.0f), yc(kc, 0.0f), expectedCoarse(kc, 0.0f);
+        for (int j = 0; j < cols; j++)
+            for (int i = 0; i < rows; i++) xf[(size_t)j * rows + i] = xc[(size_t)(j / 2) * rc + i / 2];
+        A.multiplyAdd(xf.data(), yf.data(), 1.0f);
+        for (int j = 0; j < cols; j++)
+            for (int i = 0; i < rows; i++) expectedCoarse[(size_t)(j / 2) * rc + i / 2] += yf[(size_t)j * rows + i];
+        coarse.multiplyAdd(xc.data(), yc.data(), 1.0f);
+        TEST_CHECK(relativeDifference(yc.data(), expectedCoarse.data(), kc) < 1e-5, "coarse Neumann %dx%d", rows,
+                   cols);
+    }
+}
+
+static double relativeResidual(const SmoothingOperator& A, const float* b, const float* x)
+{
+    const size_t k = (size_t)A.rows();
+    std::vector<float> r(b, b + k);
+    A.multiplyAdd(x, r.data(), -1.0f);
+    double rr = 0, bb = 0;
+    for (size_t i = 0; i < k; i++)
+    {
+        rr += (double)r[i] * r[i];
+        bb += (double)b[i] * b[i];
+    }
+    return std::sqrt(rr / bb);
+}
+
+static void testSmoothingCG()
+{
+    // The larger size is split over the worker pool.
+    static const int sizes[][2] = { { 37, 41 }, { 257, 211 } };
+    const float tolerance = 1e-4f;
+    std::mt19937 rng(2);
+    for (const auto& size : sizes)
+    {
+        const int rows = size[0], cols = size[1];
+        const size_t k = (size_t)rows * cols;
+        FrameArena arena;
+        SmoothingOperator A;
+        A.setWeights(randomPlane(rows, cols, 0.01f, 50.0f, rng), randomPlane(rows, cols, 0.01f, 50.0f, rng),
+                     0.15f, arena);
+        const cv::Mat_<float> rhs = randomPlane(1, (int)k, 0.0f, 1.0f, rng);
+        const float* b = rhs[0];
+
+        Eigen::SparseMatrix<float> M;
+        A.assemble(M, false);
+        Eigen::ConjugateGradient<Eigen::SparseMatrix<float>, Eigen::Lower | Eigen::Upper,
+                                 Eigen::DiagonalPreconditioner<float> > reference;
+        reference.setTolerance(tolerance);
+        reference.setMaxIterations(1000);
+        reference.compute(M);
+        const Eigen::VectorXf expected = reference.solve(Eigen::Map<const Eigen::VectorXf>(b, (Eigen::Index)k));
+
+        SmoothingCG<SmoothingJacobi> jacobi;
+        jacobi.setTolerance(tolerance);
+        jacobi.setMaxIterations(1000);
+        jacobi.setArena(arena);
+        jacobi.compute(A);
+        std::vector<float> x(k);
+        jacobi.solve(b, nullptr, x.data());
+        const int jacobiIterations = jacobi.iterations();
+        // Same iteration in a different summation order: the iteration counts may differ by one
+        // and the solutions by about the tolerance.
+        TEST_CHECK(std::abs(jacobiIterations - (int)reference.iterations()) <= 1,
+                   "%dx%d: %d iterations, Eigen %d", rows, cols, jacobiIterations, (int)reference.iterations());
+        TEST_CHECK(jacobi.error() <= tolerance, "%dx%d: error %g", rows, cols, jacobi.error());
+        TEST_CHECK(relativeResidual(A, b, x.data()) <= 2 * tolerance, "%dx%d: residual %g", rows, cols,
+                   relativeResidual(A, b, x.data()));
+        TEST_CHECK(relativeDifference(x.data(), expected.data(), k) < 10 * tolerance, "%dx%d: difference %g",
+                   rows, cols, relativeDifference(x.data(), expected.data(), k));
+
+        // Started from its own solution it must stop at once.
+        jacobi.solve(b, x.data(), x.data());
+        TEST_CHECK(jacobi.iterations() <= 1, "%dx%d: warm start took %d iterations", rows, cols,
+                   jacobi.iterations());
+
+        // The operator itself as the matrix of Eigen's solver.
+        Eigen::ConjugateGradient<SmoothingOperator, Eigen::Lower | Eigen::Upper, SmoothingJacobi> matrixFree;
+        matrixFree.setTolerance(tolerance);
+        matrixFree.setMaxIterations(1000);
+        matrixFree.compute(A);
+        const Eigen::VectorXf y = matrixFree.solve(Eigen::Map<const Eigen::VectorXf>(b, (Eigen::Index)k));
+        TEST_CHECK(relativeDifference(y.data(), expected.data(), k) < 10 * tolerance,
+                   "%dx%d: Eigen on the operator, difference %g", rows, cols,
+                   relativeDifference(y.data(), expected.data(), k));
+
+        SmoothingCG<SmoothingMultigridPreconditioner> multigrid;
+        multigrid.setTolerance(tolerance);
+        multigrid.setMaxIterations(100);
+        multigrid.setArena(arena);
+        multigrid.preconditioner().setArena(arena);
+        multigrid.compute(A);
+        multigrid.solve(b, nullptr, x.data());
+        TEST_CHECK(multigrid.iterations() < jacobiIterations, "%dx%d: multigrid %d iterations, Jacobi %d",
+                   rows, cols, multigrid.iterations(), jacobiIterations);
+        TEST_CHECK(relativeResidual(A, b, x.data()) <= 2 * tolerance, "%dx%d: multigrid residual %g", rows, cols,
+                   relativeResidual(A, b, x.data()));
+    }
+}
+
+// parallelFor() inside a submitAsync() job must spread over the pool instead of running inline.
+static void testAsyncFanOut()
+{
+    if (workerPool().NumThreads() < 2) return;
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    const int id = submitAsync([&]() -> bool {
+        parallelFor(workerPool().NumThreads(), 1, [&](int, int, int)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.insert(std::this_thread::get_id());
+        });
+        return true;
+    }, nullptr);
+    int status;
+    while ((status = pollAsync(id)) == ASYNC_PENDING) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    TEST_CHECK(status == ASYNC_DONE, "status %d", status);
+    TEST_CHECK(threads.size() > 1, "the job's blocks ran on %d thread(s)", (int)threads.size());
+}
+
+// Entropy of applyK(I, k, a, b) converted to 8 bits, the way BIMEF computed it before
+// ExposureEntropy: cv::pow, scaling by beta, convertTo and calcHist.
+static float originalEntropy(const cv::Mat_<float>& I, float k, float a, float b)
+{
+    float beta = std::exp((1 - std::pow(k, a)) * b);
+    float gamma = std::pow(k, a);
+    cv::Mat_<float> J(I.size());
+    cv::pow(I, gamma, J);
+    J = J * beta;
+
+    cv::Mat_<uchar> J_uchar;
+    J.convertTo(J_uchar, CV_8U, 255);
+    cv::Mat_<float> hist;
+    const int histSize = 256;
+    float range[] = { 0, 256 };
+    const float* histRange = { range };
+    cv::calcHist(&J_uchar, 1, NULL, cv::Mat(), hist, 1, &histSize, &histRange);
+    cv::Mat_<float> hist_norm = hist / cv::sum(hist)[0];
+
+    float E = 0;
+    for (int i = 0; i < hist_norm.rows; i++)
+    {
+        if (hist_norm(i, 0) > 0)
+        {
+            E += hist_norm(i, 0) * std::log2(hist_norm(i, 0));
+        }
+    }
+    return -E;
+}
+
+// The same with pow taken element by element with std::pow, like ExposureEntropy does, which
+// it must then reproduce exactly.
+static float elementwiseEntropy(const cv::Mat_<float>& I, float k, float a, float b)
+{
+    const float gamma = std::pow(k, a);
+    const float beta = std::exp((1 - gamma) * b);
+    cv::Mat_<uchar> J(I.rows, I.cols);
+    for (int i = 0; i < I.rows; i++)
+        for (int j = 0; j < I.cols; j++)
+            J(i, j) = cv::saturate_cast<uchar>(std::pow(I(i, j), gamma) * beta * 255);
+
+    Histogram256 hist;
+    histogram256(J, hist, false);
+    const float total = (float)histogramCount(hist);
+    float E = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (hist[i] > 0)
+        {
+            float p = hist[i] / total;
+            E += p * std::log2(p);
+        }
+    }
+    return -E;
+}
+
+static void testExposureEntropy()
+{
+    std::mt19937 rng(3);
+    // BIMEF's 50x50 estimate of a smooth image, and of an 8-bit one (samples on exact levels).
+    cv::Mat_<float> smooth = randomPlane(50, 50, 0.0f, 1.0f, rng);
+    cv::Mat_<float> quantised(50, 50);
+    std::uniform_int_distribution<int> level(0, 255);
+    for (int i = 0; i < quantised.rows; i++)
+        for (int j = 0; j < quantised.cols; j++)
+            quantised(i, j) = level(rng) / 255.0f;
+    smooth(0, 0) = 0.0f;
+    smooth(0, 1) = 1.0f;
+
+    // cv::pow is only accurate to a few ulps, which can move a sample lying on a level boundary
+    // to the neighbouring level. Moving one of n samples changes the entropy by at most
+    // 2 (log2 n + 1 / ln 2) / n; two such samples are allowed against the original.
+    const float n = (float)smooth.total();
+    const float originalTolerance = 2 * 2 * (std::log2(n) + 1.4427f) / n;
+
+    // BIMEF's default camera response and another one, which must be used as given.
+    static const float responses[][2] = { { -0.3293f, 1.1258f }, { -0.25f, 0.9f } };
+    static const double ks[] = { 1.0, 1.25, 2.0, 3.7, 5.0, 7.0, 7.0, 1.25 };
+    for (const cv::Mat_<float>* I : { &smooth, &quantised })
+        for (const float* response : responses)
+        {
+            const float a = response[0], b = response[1];
+            ExposureEntropy entropy(*I, a, b);
+            for (double k : ks)
+            {
+                const float actual = entropy(k);
+                const float elementwise = elementwiseEntropy(*I, (float)k, a, b);
+                const float original = originalEntropy(*I, (float)k, a, b);
+                const char* name = I == &smooth ? "smooth" : "quantised";
+                TEST_CHECK(std::abs(actual - elementwise) <= 1e-6f * std::max(1.0f, elementwise),
+                           "%s a=%g b=%g k=%g: %.7f, element-wise %.7f", name, a, b, k, actual, elementwise);
+                TEST_CHECK(std::abs(actual - original) <= originalTolerance,
+                           "%s a=%g b=%g k=%g: %.7f, original %.7f", name, a, b, k, actual, original);
+            }
+        }
+}
+
+// cvtColor(HSV_FULL), the table on V, cvtColor back, as the enhancers did before ValueGain.
+// The conversion is done on float data: the 8-bit round trip quantises hue and saturation and
+// is off by up to 9 levels even with an identity table, which would hide any real mistake.
+// V is rounded to its 8-bit level for the lookup, the result to 8 bits at the end.
+static cv::Mat hsvValueLUT(const cv::Mat& src, const std::array<uchar, 256>& lut)
+{
+    cv::Mat f, hsv, bgr, dst;
+    src.convertTo(f, CV_32F, 1.0 / 255);
+    cv::cvtColor(f, hsv, cv::COLOR_BGR2HSV_FULL);
+    for (auto it = hsv.begin<cv::Vec3f>(); it != hsv.end<cv::Vec3f>(); ++it)
+        (*it)[2] = lut[cv::saturate_cast<uchar>((*it)[2] * 255)] / 255.0f;
+    cv::cvtColor(hsv, bgr, cv::COLOR_HSV2BGR_FULL);
+    bgr.convertTo(dst, CV_8U, 255);
+    return dst;
+}
+
+// applyValueLUT must match the HSV path within one level (the rounding of its 16.16 gain and
+// of the float reference), on random colours, saturated colours (one channel at 0 and one at
+// 255) and near-black pixels, where lut[V] / V is largest.
+static void testValueGain()
+{
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<int> any(0, 255), dark(0, 7);
+    cv::Mat_<cv::Vec3b> random(64, 64), saturated(64, 64), nearBlack(64, 64);
+    for (int i = 0; i < 64; i++)
+        for (int j = 0; j < 64; j++)
+        {
+            random(i, j) = cv::Vec3b(any(rng), any(rng), any(rng));
+            saturated(i, j) = cv::Vec3b(0, j < 32 ? 255 : any(rng), any(rng));
+            nearBlack(i, j) = cv::Vec3b(dark(rng), dark(rng), dark(rng));
+        }
+
+    std::array<uchar, 256> brighten, darken, lift;
+    for (int v = 0; v < 256; v++)
+    {
+        brighten[v] = cv::saturate_cast<uchar>(255 * std::pow(v / 255.0, 0.5));
+        darken[v] = cv::saturate_cast<uchar>(255 * std::pow(v / 255.0, 2.0));
+        lift[v] = cv::saturate_cast<uchar>(20 + 235 * std::pow(v / 255.0, 0.4));
+    }
+
+    const char* imageNames[] = { "random", "saturated", "near-black" };
+    const cv::Mat images[] = { random, saturated, nearBlack };
+    const char* lutNames[] = { "gamma 0.5", "gamma 2", "lift" };
+    const std::array<uchar, 256>* luts[] = { &brighten, &darken, &lift };
+    for (int i = 0; i < 3; i++)
+        for (int l = 0; l < 3; l++)
+        {
+            cv::Mat actual;
+            applyValueLUT(images[i], actual, *luts[l]);
+            const double diff = cv::norm(actual, hsvValueLUT(images[i], *luts[l]), cv::NORM_INF);
+            TEST_CHECK(diff <= 1, "%s, %s: differs from the HSV path by %g levels", imageNames[i], lutNames[l], diff);
+        }
+
+    // An RGBA dst is written in place with the alpha of src.
+    cv::Mat rgba, alpha(random.size(), CV_8U), dst(random.size(), CV_8UC4);
+    cv::randu(alpha, 0, 256);
+    cv::Mat planes[] = { random, alpha };
+    cv::merge(planes, 2, rgba);
+    const uchar* data = dst.data;
+    applyValueLUT(rgba, dst, brighten);
+    cv::Mat colour, dstAlpha;
+    cv::cvtColor(dst, colour, cv::COLOR_BGRA2BGR);
+    cv::extractChannel(dst, dstAlpha, 3);
+    TEST_CHECK(dst.data == data, "RGBA dst was reallocated");
+    TEST_CHECK(cv::norm(dstAlpha, alpha, cv::NORM_INF) == 0, "alpha changed");
+    TEST_CHECK(cv::norm(colour, hsvValueLUT(random, brighten), cv::NORM_INF) <= 1, "RGBA colour differs");
+}
+
+static cv::Mat randomImage(int rows, int cols, int type, int lo, int hi)
+{
+    cv::Mat m(rows, cols, type);
+    cv::randu(m, cv::Scalar::all(lo), cv::Scalar::all(hi));
+    return m;
+}
+
+static bool sameHistogram(const Histogram256& hist, const cv::Mat& reference)
+{
+    cv::Mat_<float> expected;
+    const int histSize = 256;
+    float range[] = { 0, 256 };
+    const float* histRange = { range };
+    cv::calcHist(&reference, 1, NULL, cv::Mat(), expected, 1, &histSize, &histRange);
+    for (int i = 0; i < 256; i++)
+    {
+        if (hist[i] != (uint32_t)expected(i, 0)) return false;
+    }
+    return true;
+}
+
+static void testHistograms()
+{
+    cv::theRNG().state = 5;
+    // Above kParallelMinPixels, so the parallel call splits into stripes; the ROI has a stride.
+    cv::Mat gray = randomImage(600, 500, CV_8UC1, 0, 256);
+    cv::Mat roi = gray(cv::Rect(3, 7, 401, 333));
+    for (const cv::Mat* image : { &gray, &roi })
+        for (bool parallel : { false, true })
+        {
+            Histogram256 hist;
+            histogram256(*image, hist, parallel);
+            TEST_CHECK(sameHistogram(hist, *image), "histogram256 %dx%d parallel=%d differs from calcHist",
+                       image->cols, image->rows, (int)parallel);
+        }
+
+    for (int type : { CV_8UC3, CV_8UC4 })
+    {
+        cv::Mat colour = randomImage(600, 500, type, 0, 256);
+        std::vector<cv::Mat> planes;
+        cv::split(colour, planes);
+        cv::Mat value = cv::max(planes[0], cv::max(planes[1], planes[2]));
+        for (bool parallel : { false, true })
+        {
+            Histogram256 hist;
+            histogramMaxRGB(colour, hist, parallel);
+            TEST_CHECK(sameHistogram(hist, value), "histogramMaxRGB %d channels parallel=%d differs from calcHist",
+                       colour.channels(), (int)parallel);
+        }
+
+        double mean, stddev;
+        Histogram256 hist;
+        histogramMaxRGB(colour, hist);
+        histogramMeanStdDev(hist, mean, stddev);
+        cv::Scalar expectedMean, expectedStddev;
+        cv::meanStdDev(value, expectedMean, expectedStddev);
+        TEST_CHECK(std::abs(mean - expectedMean[0] / 255) < 1e-9 && std::abs(stddev - expectedStddev[0] / 255) < 1e-9,
+                   "histogramMeanStdDev %g %g, meanStdDev %g %g", mean, stddev, expectedMean[0] / 255,
+                   expectedStddev[0] / 255);
+    }
+
+    // 10-bit data with some out-of-range values, which go to the last bin.
+    cv::Mat deep = randomImage(600, 500, CV_16UC3, 0, 1200);
+    std::vector<uint32_t> expected(1024, 0);
+    for (int i = 0; i < deep.rows; i++)
+        for (int j = 0; j < deep.cols; j++)
+        {
+            const cv::Vec3w& p = deep.at<cv::Vec3w>(i, j);
+            expected[std::min(1023, (int)std::max(p[0], std::max(p[1], p[2])))]++;
+        }
+    for (bool parallel : { false, true })
+    {
+        std::vector<uint32_t> hist;
+        histogram16(deep, hist, 10, parallel);
+        TEST_CHECK(hist == expected, "histogram16 parallel=%d differs from a direct count", (int)parallel);
+    }
+
+    // Sampling reads one pixel per block, partial blocks included, and only values that occur.
+    cv::Mat twoLevels = randomImage(601, 503, CV_8UC1, 0, 2) * 200;
+    Histogram256 sampled;
+    histogram256(twoLevels, sampled, true, 8);
+    TEST_CHECK(histogramCount(sampled) == (size_t)76 * 63, "%d samples at step 8", (int)histogramCount(sampled));
+    TEST_CHECK(sampled[0] + sampled[200] == histogramCount(sampled), "sampled values that do not occur");
+}
+
+// Adjacent point stages are fused into one table that must give what the stages give one
+// after the other, with alpha left alone; any other stage breaks the run.
+static void testPipelineFusion()
+{
+    cv::theRNG().state = 6;
+    const cv::Mat src = randomImage(40, 30, CV_8UC4, 0, 256);
+    EnhanceSession session;
+
+    Pipeline fused("gamma:0.6|stretch:40,20,200,230|gamma:1.5");
+    TEST_CHECK(fused.stepCount() == 1, "%d steps after fusion", (int)fused.stepCount());
+    TEST_CHECK(fused.stepCount() == 1 && fused.stepName(0) == "gamma+stretch+gamma", "fused step named %s",
+               fused.stepName(0).c_str());
+    cv::Mat actual(src.size(), CV_8UC4);
+    fused.run(src, actual, session);
+
+    cv::Mat expected = src.clone(), next(src.size(), CV_8UC4);
+    for (const char* single : { "gamma:0.6", "stretch:40,20,200,230", "gamma:1.5" })
+    {
+        Pipeline(single).run(expected, next, session);
+        next.copyTo(expected);
+    }
+    TEST_CHECK(cv::norm(actual, expected, cv::NORM_INF) == 0, "fused steps differ from running them in turn");
+    cv::Mat alpha, srcAlpha;
+    cv::extractChannel(actual, alpha, 3);
+    cv::extractChannel(src, srcAlpha, 3);
+    TEST_CHECK(cv::norm(alpha, srcAlpha, cv::NORM_INF) == 0, "a point step changed alpha");
+
+    Pipeline split("gamma:0.6|bgr|stretch:40,20,200,230");
+    TEST_CHECK(split.stepCount() == 3, "%d steps with a stage between the point stages", (int)split.stepCount());
+}
+
+// A frame that spills over several blocks leaves one block of its peak size after reset(), and
+// the next frame of the same shape is served from it without touching the heap.
+static void testFrameArena()
+{
+    FrameArena arena;
+    const size_t sizes[] = { 700 << 10, 900 << 10, 1500 << 10 };
+    for (size_t bytes : sizes) arena.allocate(bytes);
+    const size_t peak = arena.peakBytes();
+    TEST_CHECK(arena.capacity() > peak, "capacity %d, peak %d: the frame fitted one block", (int)arena.capacity(),
+               (int)peak);
+
+    arena.reset();
+    TEST_CHECK(arena.capacity() == peak, "capacity %d after reset, peak %d", (int)arena.capacity(), (int)peak);
+    for (int frame = 0; frame < 3; frame++)
+    {
+        uchar* first = static_cast<uchar*>(arena.allocate(sizes[0]));
+        uchar* second = static_cast<uchar*>(arena.allocate(sizes[1]));
+        uchar* third = static_cast<uchar*>(arena.allocate(sizes[2]));
+        TEST_CHECK(second == first + sizes[0] && third == second + sizes[1], "frame %d is not in one block", frame);
+        TEST_CHECK(arena.capacity() == peak && arena.peakBytes() == peak, "frame %d: capacity %d, peak %d", frame,
+                   (int)arena.capacity(), (int)arena.peakBytes());
+        arena.reset();
+    }
+
+    arena.release();
+    TEST_CHECK(arena.capacity() == 0, "capacity %d after release", (int)arena.capacity());
+}
+
+// With the default smoothing (0.2) and threshold (0.02), sensor noise moves the smoothed
+// histogram by about 0.006 and keeps the table, while a cut to a dark scene moves it by 0.2.
+static void testStreamingAGCWD()
+{
+    cv::theRNG().state = 7;
+    const cv::Mat scene = randomImage(256, 256, CV_8UC3, 0, 256);
+    cv::Mat noise(scene.size(), CV_16SC3), noisy;
+    cv::randu(noise, cv::Scalar::all(-2), cv::Scalar::all(3));
+    cv::add(scene, noise, noisy, cv::noArray(), CV_8UC3);
+    const cv::Mat dark = randomImage(256, 256, CV_8UC3, 0, 41);
+
+    StreamingAGCWD stream;
+    cv::Mat first, dst;
+    stream.process(scene, first);
+    TEST_CHECK(stream.tableRebuilt(), "no table for the first frame");
+    stream.process(scene, dst);
+    TEST_CHECK(!stream.tableRebuilt(), "rebuilt for the same frame");
+    TEST_CHECK(cv::norm(dst, first, cv::NORM_INF) == 0, "same frame, different output");
+    stream.process(noisy, dst);
+    TEST_CHECK(!stream.tableRebuilt(), "rebuilt for sensor noise");
+    stream.process(dark, dst);
+    TEST_CHECK(stream.tableRebuilt(), "kept the table across a scene change");
+
+    stream.reset();
+    stream.process(scene, dst);
+    TEST_CHECK(stream.tableRebuilt(), "kept the table across reset()");
+    TEST_CHECK(cv::norm(dst, first, cv::NORM_INF) == 0, "history left after reset()");
+}
+
+static void testAGCWDLocal()
+{
+    cv::theRNG().state = 8;
+    // One tile is global AGCWD: exactly for gray images, within the rounding of the float gain
+    // against ValueGain's fixed point for colour ones.
+    for (int type : { CV_8UC1, CV_8UC3 })
+    {
+        const cv::Mat src = randomImage(96, 128, type, 0, 200);
+        cv::Mat local, global;
+        AGCWDLocal(src, local, 1);
+        AGCWD(src, global);
+        const double diff = cv::norm(local, global, cv::NORM_INF);
+        TEST_CHECK(diff <= (type == CV_8UC1 ? 0 : 1), "one tile, %d channels: %g from AGCWD", src.channels(), diff);
+    }
+
+    // A dark left half next to a bright right half: the global table spends its range on the
+    // bright pixels, the left tile's table brightens the dark ones (to about 100 against 40).
+    cv::Mat src(128, 128, CV_8UC1);
+    cv::randu(src.colRange(0, 64), 10, 41);
+    cv::randu(src.colRange(64, 128), 150, 251);
+    cv::Mat local, global;
+    AGCWDLocal(src, local, 2);
+    AGCWD(src, global);
+    const double localMean = cv::mean(local.colRange(0, 32))[0];
+    const double globalMean = cv::mean(global.colRange(0, 32))[0];
+    TEST_CHECK(localMean > 1.5 * globalMean, "dark region: %g with tiles, %g without", localMean, globalMean);
+}
+
+int main()
+{
+    testAssemble();
+    testNeumann();
+    testSmoothingCG();
+    testExposureEntropy();
+    testValueGain();
+    testHistograms();
+    testPipelineFusion();
+    testFrameArena();
+    testStreamingAGCWD();
+    testAGCWDLocal();
+    testAsyncFanOut();
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
@@ -4,6 +4,7 @@
 
 #include "opencv2/core.hpp"
 #include <array>
+#include "intensity_transform.h"
 using namespace cv;
 using namespace std;
 
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+
+// Declarations for intensity_transform.cpp (port of the OpenCV contrib intensity_transform module).
+namespace cv {
+    namespace intensity_transform {
+
+        void logTransform(const Mat input, Mat& output);
+        void gammaCorrection(const Mat input, Mat& output, const float gamma);
+        void autoscaling(const Mat input, Mat& output);
+        void contrastStretching(const Mat input, Mat& output, const int r1, const int s1, const int r2, const int s2);
+
+    }
+} // cv::intensity_transform::
@@ -7,6 +7,14 @@
 #include "AGCIE.h"
 #include "AGCWD.h"
 #include "BIMEF_Trial.h"
+#include "EnhanceSession.h"
+#include "Enhance.h"
+#include "WorkerPool.h"
+#include "Batch.h"
+#include "Pipeline.h"
+#include "Trace.h"
+#include <memory>
+#include <vector>
 #include <android/log.h>
 
 #define LOGE(...)  __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
@@ -99,6 +107,117 @@ void MatToBitmap(JNIEnv * env, Mat& src, jobject bitmap, jboolean needPremultipl
     }
 }
 
+// Pixels of a Java bitmap seen as a Mat. RGBA_8888 bitmaps are locked and wrapped in place,
+// with the bitmap's real stride, so the algorithms read and write the Java pixels directly
+// instead of going through the copies made by BitmapToMat/MatToBitmap. Other formats need a
+// real conversion anyway and fall back to those two functions.
+class BitmapMat
+{
+public:
+    BitmapMat(JNIEnv * env, jobject bitmap) : env(env), bitmap(bitmap), locked(false)
+    {
+        AndroidBitmapInfo  info;
+        void*              data = 0;
+
+        CV_Assert( AndroidBitmap_getInfo(env, bitmap, &info) >= 0 );
+        if( info.format == ANDROID_BITMAP_FORMAT_RGBA_8888 )
+        {
+            CV_Assert( AndroidBitmap_lockPixels(env, bitmap, &data) >= 0 );
+            locked = true;
+            CV_Assert( data );
+            pixels = Mat(info.height, info.width, CV_8UC4, data, info.stride);
+            mat = pixels;
+        }
+        else
+        {
+            BitmapToMat(env, bitmap, mat, false);
+        }
+    }
+
+    ~BitmapMat()
+    {
+        if( locked ) AndroidBitmap_unlockPixels(env, bitmap);
+    }
+
+    // Stores `mat` into the bitmap. Nothing is copied when the algorithm already wrote its
+    // result straight into the locked pixels.
+    void commit()
+    {
+        if( !locked )
+        {
+            MatToBitmap(env, mat, bitmap, false);
+            return;
+        }
+        if( mat.data == pixels.data ) return;
+        CV_Assert( mat.dims == 2 && mat.size() == pixels.size() );
+        if( mat.type() == CV_8UC1 ) cvtColor(mat, pixels, COLOR_GRAY2RGBA);
+        else if( mat.type() == CV_8UC3 ) cvtColor(mat, pixels, COLOR_RGB2RGBA);
+        else if( mat.type() == CV_8UC4 ) mat.copyTo(pixels);
+        else CV_Error(Error::StsUnsupportedFormat, "Unsupported result type in JNI code {BitmapMat}");
+    }
+
+    Mat mat;
+
+private:
+    BitmapMat(const BitmapMat&);
+    BitmapMat& operator=(const BitmapMat&);
+
+    JNIEnv * env;
+    jobject bitmap;
+    bool locked;
+    Mat pixels;
+};
+
+static void ThrowJavaException(JNIEnv * env, const char * msg)
+{
+    jclass je = env->FindClass("java/lang/Exception");
+    env->ThrowNew(je, msg);
+}
+
+static JavaVM* javaVM = 0;
+
+extern "C" JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM* vm, void* /* reserved */) {
+    javaVM = vm;
+    return JNI_VERSION_1_6;
+}
+
+// Attaches a native worker thread to the VM the first time it calls into Java, and detaches
+// it again when the thread exits.
+struct ThreadAttachment
+{
+    ThreadAttachment() : env(0) {}
+    ~ThreadAttachment() { if (env) javaVM->DetachCurrentThread(); }
+    JNIEnv* env;
+};
+
+static JNIEnv* AttachedEnv()
+{
+    thread_local ThreadAttachment attachment;
+    if (!attachment.env) javaVM->AttachCurrentThread(&attachment.env, 0);
+    return attachment.env;
+}
+
+static EnhanceSession& SessionFromHandle(jlong handle)
+{
+    CV_Assert( handle != 0 );
+    return *reinterpret_cast<EnhanceSession*>(handle);
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_myapplication_MainActivity_createSession(
+        JNIEnv* env,
+        jobject /* this */) {
+    return reinterpret_cast<jlong>(new EnhanceSession());
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_myapplication_MainActivity_releaseSession(
+        JNIEnv* env,
+        jobject /* this */, jlong session) {
+    delete reinterpret_cast<EnhanceSession*>(session);
+}
+
 extern "C" JNIEXPORT jstring JNICALL
 Java_com_example_myapplication_MainActivity_stringFromJNI(
         JNIEnv* env,
@@ -120,142 +239,378 @@ Java_com_example_myapplication_MainActivity_myFlip(
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_myapplication_MainActivity_AGCIE(
         JNIEnv* env,
-        jobject /* this */, jobject bitmapIn, jobject bitmapOut) {
-    Mat AGCIE_dst;
-    Mat src;
-    BitmapToMat(env, bitmapIn , src, false);
-    auto start = std::chrono::high_resolution_clock::now();
-    AGCIE(src, AGCIE_dst);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = (end-start)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCIE is : %d", duration);
-    MatToBitmap(env,AGCIE_dst,bitmapOut,false);
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI AGCIE");
+        EnhanceSession& ses = SessionFromHandle(session);
+        BitmapMat src(env, bitmapIn);
+        BitmapMat dst(env, bitmapOut);
+        if (env->ExceptionCheck()) return;
+        auto start = std::chrono::high_resolution_clock::now();
+        AGCIE(src.mat, dst.mat, ses.buffers);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = (end-start)/1000000;
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCIE is : %d", duration);
+        dst.commit();
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {AGCIE}");
+    }
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_myapplication_MainActivity_BIMEF(
         JNIEnv* env,
-        jobject /* this */, jobject bitmapIn, jobject bitmapOut) {
-    Mat BIMEF_dst;
-    Mat src;
-    BitmapToMat(env, bitmapIn , src, false);
-    auto start = std::chrono::high_resolution_clock::now();
-    BIMEF(src, BIMEF_dst);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = (end-start)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for BIMEF is : %d", duration);
-    MatToBitmap(env,BIMEF_dst,bitmapOut,false);
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI BIMEF");
+        EnhanceSession& ses = SessionFromHandle(session);
+        BitmapMat src(env, bitmapIn);
+        BitmapMat dst(env, bitmapOut);
+        if (env->ExceptionCheck()) return;
+        auto start = std::chrono::high_resolution_clock::now();
+        BIMEF(src.mat, dst.mat, ses.buffers);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = (end-start)/1000000;
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for BIMEF is : %d", duration);
+        dst.commit();
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {BIMEF}");
+    }
+}
+
+// Runs a pipeline description (see Pipeline.h) from bitmapIn into bitmapOut, logging the time
+// of every step. The parsed pipeline and its buffers stay cached in the session.
+static void RunPipeline(JNIEnv* env, jlong session, const std::string& description, const char* tag,
+                        jobject bitmapIn, jobject bitmapOut)
+{
+    EnhanceSession& ses = SessionFromHandle(session);
+    BitmapMat src(env, bitmapIn);
+    BitmapMat dst(env, bitmapOut);
+    if (env->ExceptionCheck()) return;
+    Pipeline& pipeline = sessionPipeline(ses, description);
+    pipeline.run(src.mat, dst.mat, ses);
+    double total = 0;
+    for (size_t i = 0; i < pipeline.stepCount(); i++) {
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for %s %s is : %.2f", tag,
+                            pipeline.stepName(i).c_str(), pipeline.stepTimes()[i]);
+        total += pipeline.stepTimes()[i];
+    }
+    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Total Time for %s is : %.2f", tag, total);
+    dst.commit();
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_myapplication_MainActivity_AGCIEDSUS(
         JNIEnv* env,
-        jobject /* this */, jobject bitmapIn, jobject bitmapOut) {
-    Mat AGCIE_dst;
-    Mat src;
-    Mat dst_ds;
-    Mat dst;
-    BitmapToMat(env, bitmapIn , src, false);
-
-    auto startds = std::chrono::high_resolution_clock::now();
-    downscaleAGCIE(src, dst_ds);
-    auto endds = std::chrono::high_resolution_clock::now();
-    auto durationds = (endds-startds)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCIE downscale is : %d", durationds);
-
-    auto start = std::chrono::high_resolution_clock::now();
-    AGCIE(dst_ds, AGCIE_dst);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = (end-start)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCIE is : %d", duration);
-
-    auto startus = std::chrono::high_resolution_clock::now();
-    upscaleAGCIE(AGCIE_dst, dst);
-    auto endus = std::chrono::high_resolution_clock::now();
-    auto durationus = (endus-startus)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCIE upscale is : %d", durationus);
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Total Time for AGCIE is : %d", durationus+durationds+duration);
-    MatToBitmap(env,dst,bitmapOut,false);
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI AGCIEDSUS");
+        RunPipeline(env, session, "downscale|AGCIE|upscale", "AGCIE", bitmapIn, bitmapOut);
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {AGCIEDSUS}");
+    }
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_myapplication_MainActivity_AGCWD(
         JNIEnv* env,
-        jobject /* this */, jobject bitmapIn, jobject bitmapOut) {
-    Mat AGCWD_dst;
-    Mat src;
-    BitmapToMat(env, bitmapIn , src, false);
-    auto start = std::chrono::high_resolution_clock::now();
-    AGCWD(src, AGCWD_dst);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = (end-start)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCWD is : %d", duration);
-    MatToBitmap(env,AGCWD_dst,bitmapOut,false);
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI AGCWD");
+        EnhanceSession& ses = SessionFromHandle(session);
+        BitmapMat src(env, bitmapIn);
+        BitmapMat dst(env, bitmapOut);
+        if (env->ExceptionCheck()) return;
+        auto start = std::chrono::high_resolution_clock::now();
+        AGCWD(src.mat, dst.mat, ses.buffers);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = (end-start)/1000000;
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCWD is : %d", duration);
+        dst.commit();
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {AGCWD}");
+    }
 }
 
+// Tiled AGCWD: adapts to dark and bright regions separately at close to LUT cost.
 extern "C" JNIEXPORT void JNICALL
-Java_com_example_myapplication_MainActivity_AGCWDDSUS(
+Java_com_example_myapplication_MainActivity_AGCWDLocal(
         JNIEnv* env,
-        jobject /* this */, jobject bitmapIn, jobject bitmapOut) {
-    Mat AGCWD_dst;
-    Mat src;
-    Mat dst_ds;
-    Mat dst;
-    BitmapToMat(env, bitmapIn , src, false);
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI AGCWDLocal");
+        BitmapMat src(env, bitmapIn);
+        BitmapMat dst(env, bitmapOut);
+        if (env->ExceptionCheck()) return;
+        auto start = std::chrono::high_resolution_clock::now();
+        AGCWDLocal(src.mat, dst.mat);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = (end-start)/1000000;
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCWDLocal is : %d", duration);
+        dst.commit();
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {AGCWDLocal}");
+    }
+}
 
-    auto startds = std::chrono::high_resolution_clock::now();
-    downscaleAGCWD(src, dst_ds);
-    auto endds = std::chrono::high_resolution_clock::now();
-    auto durationds = (endds-startds)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCWD downscale is : %d", durationds);
-
-    auto start = std::chrono::high_resolution_clock::now();
-    AGCWD(dst_ds, AGCWD_dst);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = (end-start)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCWD is : %d", duration);
-
-    auto startus = std::chrono::high_resolution_clock::now();
-    upscaleAGCWD(AGCWD_dst, dst);
-    auto endus = std::chrono::high_resolution_clock::now();
-    auto durationus = (endus-startus)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCWD upscale is : %d", durationus);
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Total Time for AGCWD is : %d", durationus+durationds+duration);
-
-    MatToBitmap(env,dst,bitmapOut,false);
+// AGCWD for consecutive preview frames: the histogram is smoothed over time and the gamma
+// table only rebuilt when the scene changes (see StreamingAGCWD.h).
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_myapplication_MainActivity_AGCWDStream(
+        JNIEnv* env,
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI AGCWDStream");
+        EnhanceSession& ses = SessionFromHandle(session);
+        BitmapMat src(env, bitmapIn);
+        BitmapMat dst(env, bitmapOut);
+        if (env->ExceptionCheck()) return;
+        auto start = std::chrono::high_resolution_clock::now();
+        ses.agcwdStream.process(src.mat, dst.mat);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = (end-start)/1000000;
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for AGCWDStream is : %d (table %s)", duration,
+                            ses.agcwdStream.tableRebuilt() ? "rebuilt" : "reused");
+        dst.commit();
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {AGCWDStream}");
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_myapplication_MainActivity_resetAGCWDStream(
+        JNIEnv* env,
+        jobject /* this */, jlong session) {
+    SessionFromHandle(session).agcwdStream.reset();
+}
+
+// BIMEF for consecutive preview frames: the illumination solve starts from the previous
+// frame's solution and k is searched near the previous one (see StreamingBIMEF.h).
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_myapplication_MainActivity_BIMEFStream(
+        JNIEnv* env,
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI BIMEFStream");
+        EnhanceSession& ses = SessionFromHandle(session);
+        BitmapMat src(env, bitmapIn);
+        BitmapMat dst(env, bitmapOut);
+        if (env->ExceptionCheck()) return;
+        auto start = std::chrono::high_resolution_clock::now();
+        ses.bimefStream.process(src.mat, dst.mat, ses.buffers);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = (end-start)/1000000;
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for BIMEFStream is : %d (%d CG iterations, k %f)",
+                            duration, ses.bimefStream.iterations(), ses.bimefStream.exposureRatio());
+        dst.commit();
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {BIMEFStream}");
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_myapplication_MainActivity_resetBIMEFStream(
+        JNIEnv* env,
+        jobject /* this */, jlong session) {
+    SessionFromHandle(session).bimefStream.reset();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_myapplication_MainActivity_AGCWDDSUS(
+        JNIEnv* env,
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI AGCWDDSUS");
+        RunPipeline(env, session, "downscale|AGCWD|upscale", "AGCWD", bitmapIn, bitmapOut);
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {AGCWDDSUS}");
+    }
 }
 
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_myapplication_MainActivity_BIMEFDSUS(
         JNIEnv* env,
-        jobject /* this */, jobject bitmapIn, jobject bitmapOut) {
-    Mat BIMEF_dst;
-    Mat src;
-    Mat dst_ds;
-    Mat dst;
-    BitmapToMat(env, bitmapIn , src, false);
+        jobject /* this */, jlong session, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI BIMEFDSUS");
+        RunPipeline(env, session, "downscale|BIMEF|upscale", "BIMEF", bitmapIn, bitmapOut);
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {BIMEFDSUS}");
+    }
+}
+
+// Runs an arbitrary pipeline description, e.g. "downscale:0.25|BIMEF|upscale|gamma:0.9".
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_myapplication_MainActivity_runPipeline(
+        JNIEnv* env,
+        jobject /* this */, jlong session, jstring description, jobject bitmapIn, jobject bitmapOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI runPipeline");
+        const char* chars = env->GetStringUTFChars(description, 0);
+        std::string desc(chars);
+        env->ReleaseStringUTFChars(description, chars);
+        RunPipeline(env, session, desc, "pipeline", bitmapIn, bitmapOut);
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {runPipeline}");
+    }
+}
+
+// Enhances bitmapIn into bitmapOut in the background (see submitAsync) and returns a request
+// id right away. callback (may be null) gets onEnhanceDone(requestId, ok) on the job thread;
+// without one, poll the status with pollEnhance. Neither bitmap may be touched until then.
+// The stream algorithms are rejected (see checkPoolAlgorithm); they have their own calls on
+// the caller's session.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_myapplication_MainActivity_submitEnhance(
+        JNIEnv* env,
+        jobject /* this */, jint algorithm, jobject bitmapIn, jobject bitmapOut, jobject callback) {
+    try {
+        checkPoolAlgorithm(algorithm);
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+        return 0;
+    }
+    jobject in = env->NewGlobalRef(bitmapIn);
+    jobject out = env->NewGlobalRef(bitmapOut);
+    jobject cb = callback ? env->NewGlobalRef(callback) : 0;
 
-    auto startds = std::chrono::high_resolution_clock::now();
-    downscaleBIMEF(src, dst_ds);
-    auto endds = std::chrono::high_resolution_clock::now();
-    auto durationds = (endds-startds)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for BIMEF downscale is : %d", durationds);
-
-    auto start = std::chrono::high_resolution_clock::now();
-    BIMEF(dst_ds, BIMEF_dst);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = (end-start)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for BIMEF is : %d", duration);
-
-    auto startus = std::chrono::high_resolution_clock::now();
-    upscaleBIMEF(BIMEF_dst, dst);
-    auto endus = std::chrono::high_resolution_clock::now();
-    auto durationus = (endus-startus)/1000000;
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for BIMEF upscale is : %d", durationus);
-    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Total Time for BIMEF is : %d", durationus+durationds+duration);
-
-    MatToBitmap(env,dst,bitmapOut,false);
+    return submitAsync(
+            [=]() -> bool {
+                JNIEnv* wenv = AttachedEnv();
+                try {
+                    IMGPROC_TRACE_SCOPE("JNI submitEnhance job");
+                    BitmapMat src(wenv, in);
+                    BitmapMat dst(wenv, out);
+                    if (!wenv->ExceptionCheck()) {
+                        auto start = std::chrono::high_resolution_clock::now();
+                        enhance(algorithm, src.mat, dst.mat, asyncSession());
+                        auto end = std::chrono::high_resolution_clock::now();
+                        auto duration = (end-start)/1000000;
+                        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for async %s is : %d", enhanceAlgorithmName(algorithm), duration);
+                        dst.commit();
+                    }
+                } catch(const cv::Exception& e) {
+                    __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Async %s failed : %s", enhanceAlgorithmName(algorithm), e.what());
+                    trimSession(asyncSession(), kWorkerSessionBytes);
+                    return false;
+                }
+                trimSession(asyncSession(), kWorkerSessionBytes);
+                if (wenv->ExceptionCheck()) {
+                    wenv->ExceptionDescribe();
+                    wenv->ExceptionClear();
+                    return false;
+                }
+                return true;
+            },
+            [=](int id, bool ok) -> bool {
+                JNIEnv* wenv = AttachedEnv();
+                bool delivered = false;
+                if (cb) {
+                    jclass cls = wenv->GetObjectClass(cb);
+                    jmethodID onDone = wenv->GetMethodID(cls, "onEnhanceDone", "(IZ)V");
+                    if (onDone) {
+                        wenv->CallVoidMethod(cb, onDone, (jint)id, (jboolean)(ok ? JNI_TRUE : JNI_FALSE));
+                        delivered = true;
+                    }
+                    if (wenv->ExceptionCheck()) {
+                        wenv->ExceptionDescribe();
+                        wenv->ExceptionClear();
+                    }
+                    wenv->DeleteLocalRef(cls);
+                    wenv->DeleteGlobalRef(cb);
+                }
+                wenv->DeleteGlobalRef(in);
+                wenv->DeleteGlobalRef(out);
+                // Without a Java callback the caller polls, so the status must be kept.
+                return delivered;
+            });
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_myapplication_MainActivity_pollEnhance(
+        JNIEnv* env,
+        jobject /* this */, jint requestId) {
+    return pollAsync(requestId);
+}
+
+// Enhances bitmapsIn[i] into bitmapsOut[i] for every i in one call, spreading the images over
+// all cores. Returns the processing time of each image in milliseconds.
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_com_example_myapplication_MainActivity_enhanceBatch(
+        JNIEnv* env,
+        jobject /* this */, jint algorithm, jobjectArray bitmapsIn, jobjectArray bitmapsOut) {
+    try {
+        IMGPROC_TRACE_SCOPE("JNI enhanceBatch");
+        jsize n = env->GetArrayLength(bitmapsIn);
+        CV_Assert( env->GetArrayLength(bitmapsOut) == n );
+        // Every bitmap stays locked, and so referenced, until its result is committed.
+        CV_Assert( env->EnsureLocalCapacity(2 * n) == 0 );
+
+        std::vector<std::unique_ptr<BitmapMat> > src(n), dst(n);
+        std::vector<Mat> inputs(n), outputs(n);
+        for (jsize i = 0; i < n; i++) {
+            jobject in = env->GetObjectArrayElement(bitmapsIn, i);
+            jobject out = env->GetObjectArrayElement(bitmapsOut, i);
+            src[i].reset(new BitmapMat(env, in));
+            dst[i].reset(new BitmapMat(env, out));
+            if (env->ExceptionCheck()) return 0;
+            inputs[i] = src[i]->mat;
+            outputs[i] = dst[i]->mat;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<double> timings = enhanceBatch(algorithm, inputs, outputs);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = (end-start)/1000000;
+        __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", " [IMG_PROC] Time for batch %s of %d images is : %d", enhanceAlgorithmName(algorithm), n, duration);
+
+        for (jsize i = 0; i < n; i++) {
+            dst[i]->mat = outputs[i];
+            dst[i]->commit();
+        }
+
+        jdoubleArray result = env->NewDoubleArray(n);
+        env->SetDoubleArrayRegion(result, 0, n, timings.data());
+        return result;
+    } catch(const cv::Exception& e) {
+        ThrowJavaException(env, e.what());
+    } catch (...) {
+        ThrowJavaException(env, "Unknown exception in JNI code {enhanceBatch}");
+    }
+    return 0;
+}
+
+// Writes the trace points recorded so far as Chrome/Perfetto JSON. Always false unless the
+// library was built with IMGPROC_TRACE.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_myapplication_MainActivity_exportTrace(
+        JNIEnv* env,
+        jobject /* this */, jstring path) {
+    const char* cpath = env->GetStringUTFChars(path, 0);
+    bool ok = IMGPROC_TRACE_EXPORT(cpath);
+    env->ReleaseStringUTFChars(path, cpath);
+    return ok ? JNI_TRUE : JNI_FALSE;
 }
 
 extern "C" JNIEXPORT void JNICALL
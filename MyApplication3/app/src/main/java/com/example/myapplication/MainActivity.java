@@ -18,8 +18,31 @@ import java.io.InputStream;
 
 public class MainActivity extends AppCompatActivity {
     private static int RESULT_LOAD_IMAGE = 1;
+    // Algorithm ids understood by submitEnhance and enhanceBatch; keep in sync with Enhance.h.
+    // The stream modes keep state in a session and only run through AGCWDStream (6) and
+    // BIMEFStream (8).
+    public static final int ALGORITHM_AGCIE = 0;
+    public static final int ALGORITHM_AGCWD = 1;
+    public static final int ALGORITHM_BIMEF = 2;
+    public static final int ALGORITHM_AGCIE_DSUS = 3;
+    public static final int ALGORITHM_AGCWD_DSUS = 4;
+    public static final int ALGORITHM_BIMEF_DSUS = 5;
+    public static final int ALGORITHM_AGCWD_LOCAL = 7;
+    // Values returned by pollEnhance; keep in sync with WorkerPool.h.
+    public static final int ASYNC_UNKNOWN = -1;
+    public static final int ASYNC_PENDING = 0;
+    public static final int ASYNC_DONE = 1;
+    public static final int ASYNC_FAILED = 2;
+
+    public interface EnhanceCallback {
+        // Called on a native worker thread once the request has finished.
+        void onEnhanceDone(int requestId, boolean ok);
+    }
+
     Bitmap srcBitmap = null;
     Bitmap dstBitmap = null;
+    // Native buffers reused across calls; see EnhanceSession.h.
+    long session = 0;
     // Used to load the 'native-lib' library on application startup.
     static {
         System.loadLibrary("native-lib");
@@ -29,40 +52,58 @@ public class MainActivity extends AppCompatActivity {
     protected void onCreate(Bundle savedInstanceState) {
         super.onCreate(savedInstanceState);
         setContentView(R.layout.activity_main);
+        session = createSession();
+    }
+
+    @Override
+    protected void onDestroy() {
+        releaseSession(session);
+        session = 0;
+        super.onDestroy();
     }
 
     public void btnAGCIE_click(View view){
-        AGCIE(srcBitmap,dstBitmap);
+        AGCIE(session,srcBitmap,dstBitmap);
         View nImg = findViewById(R.id.imageViewOutput);
         ((ImageView)nImg).setImageBitmap(dstBitmap);
     }
 
     public void btnBIMEF_click(View view){
-        BIMEF(srcBitmap,dstBitmap);
-        View nImg = findViewById(R.id.imageViewOutput);
-        ((ImageView)nImg).setImageBitmap(dstBitmap);
+        enhanceAsync(ALGORITHM_BIMEF);
     }
 
     public void btnAGCWD_click(View view){
-        AGCWD(srcBitmap,dstBitmap);
+        AGCWD(session,srcBitmap,dstBitmap);
         View nImg = findViewById(R.id.imageViewOutput);
         ((ImageView)nImg).setImageBitmap(dstBitmap);
     }
 
     public void btnAGCIEDSUS_click(View view){
-        AGCIEDSUS(srcBitmap,dstBitmap);
+        AGCIEDSUS(session,srcBitmap,dstBitmap);
         View nImg = findViewById(R.id.imageViewOutput);
         ((ImageView)nImg).setImageBitmap(dstBitmap);
     }
 
     public void btnBIMEFDSUS_click(View view){
-        BIMEFDSUS(srcBitmap,dstBitmap);
-        View nImg = findViewById(R.id.imageViewOutput);
-        ((ImageView)nImg).setImageBitmap(dstBitmap);
+        enhanceAsync(ALGORITHM_BIMEF_DSUS);
+    }
+
+    // Runs a slow algorithm on native background threads so the UI thread never blocks. The result
+    // goes into a fresh bitmap, which replaces dstBitmap once it is complete.
+    private void enhanceAsync(int algorithm){
+        final Bitmap outBitmap = srcBitmap.copy(srcBitmap.getConfig(), true);
+        submitEnhance(algorithm, srcBitmap, outBitmap, (requestId, ok) -> {
+            if (!ok) return;
+            runOnUiThread(() -> {
+                dstBitmap = outBitmap;
+                View nImg = findViewById(R.id.imageViewOutput);
+                ((ImageView)nImg).setImageBitmap(dstBitmap);
+            });
+        });
     }
 
     public void btnAGCWDDSUS_click(View view){
-        AGCWDDSUS(srcBitmap,dstBitmap);
+        AGCWDDSUS(session,srcBitmap,dstBitmap);
         View nImg = findViewById(R.id.imageViewOutput);
         ((ImageView)nImg).setImageBitmap(dstBitmap);
     }
@@ -95,13 +136,28 @@ public class MainActivity extends AppCompatActivity {
     }
 
     public native String stringFromJNI();
+    public native long createSession();
+    public native void releaseSession(long session);
+    public native int submitEnhance(int algorithm, Bitmap bitmapIn, Bitmap bitmapOut, EnhanceCallback callback);
+    public native int pollEnhance(int requestId);
+    public native double[] enhanceBatch(int algorithm, Bitmap[] bitmapsIn, Bitmap[] bitmapsOut);
+    public native boolean exportTrace(String path);
     public native void myFlip(Bitmap bitmapIn,Bitmap bitmapOut);
-    public native void AGCIE(Bitmap bitmapIn,Bitmap bitmapOut);
-    public native void BIMEF(Bitmap bitmapIn,Bitmap bitmapOut);
-    public native void AGCWD(Bitmap bitmapIn,Bitmap bitmapOut);
-    public native void AGCIEDSUS(Bitmap bitmapIn,Bitmap bitmapOut);
-    public native void AGCWDDSUS(Bitmap bitmapIn,Bitmap bitmapOut);
-    public native void BIMEFDSUS(Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void AGCIE(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void BIMEF(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void AGCWD(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void AGCIEDSUS(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void AGCWDDSUS(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    // Temporal AGCWD for preview frames; the histogram history lives in the session.
+    public native void AGCWDStream(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void resetAGCWDStream(long session);
+    public native void AGCWDLocal(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void BIMEFDSUS(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    // Warm-started BIMEF for preview frames; the previous frame's solution lives in the session.
+    public native void BIMEFStream(long session,Bitmap bitmapIn,Bitmap bitmapOut);
+    public native void resetBIMEFStream(long session);
+    // description: stages separated by '|', e.g. "downscale|BIMEF|upscale"; see Pipeline.h.
+    public native void runPipeline(long session,String description,Bitmap bitmapIn,Bitmap bitmapOut);
 
 
     //public native fun myBlur(Bitmap bitmapIn,Bitmap bitmapOut, Float sigma);